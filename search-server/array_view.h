@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Read-only view of a contiguous array owned by a vector or a mapped file
+template <typename T>
+class ArrayView {
+public:
+    ArrayView() = default;
+
+    ArrayView(const T* data, size_t size)
+        : data_(data)
+        , size_(size) {
+    }
+
+    ArrayView(const std::vector<T>& items)
+        : data_(items.data())
+        , size_(items.size()) {
+    }
+
+    const T* begin() const {
+        return data_;
+    }
+
+    const T* end() const {
+        return data_ + size_;
+    }
+
+    const T* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    const T& operator[](size_t index) const {
+        return data_[index];
+    }
+
+private:
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,48 @@
+#include "cancellation.h"
+
+#include <string>
+
+using namespace std;
+
+QueryCancelledError::QueryCancelledError()
+    : runtime_error("Query is cancelled"s) {
+}
+
+CancellationToken CancellationToken::WithDeadline(chrono::steady_clock::time_point deadline) const {
+    CancellationToken token = *this;
+    if (!token.deadline_ || deadline < *token.deadline_) {
+        token.deadline_ = deadline;
+    }
+    return token;
+}
+
+bool CancellationToken::IsCancelled() const {
+    if (is_cancelled_ && is_cancelled_->load(memory_order_relaxed)) {
+        return true;
+    }
+    return deadline_ && chrono::steady_clock::now() >= *deadline_;
+}
+
+bool CancellationToken::CanBeCancelled() const {
+    return is_cancelled_ != nullptr || deadline_.has_value();
+}
+
+void CancellationToken::ThrowIfCancelled() const {
+    if (IsCancelled()) {
+        throw QueryCancelledError();
+    }
+}
+
+CancellationSource::CancellationSource()
+    : is_cancelled_(make_shared<atomic<bool>>(false)) {
+}
+
+CancellationToken CancellationSource::GetToken() const {
+    CancellationToken token;
+    token.is_cancelled_ = is_cancelled_;
+    return token;
+}
+
+void CancellationSource::Cancel() {
+    is_cancelled_->store(true, memory_order_relaxed);
+}
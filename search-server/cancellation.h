@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+
+// Thrown by the futures of queries which were cancelled before they ran
+class QueryCancelledError : public std::runtime_error {
+public:
+    QueryCancelledError();
+};
+
+// Tells a query whether it is still wanted. A default token is never cancelled.
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    // Copy of the token which is also cancelled once the deadline passes
+    CancellationToken WithDeadline(std::chrono::steady_clock::time_point deadline) const;
+
+    bool IsCancelled() const;
+
+    // False for default tokens, which are never cancelled
+    bool CanBeCancelled() const;
+
+    // Throws QueryCancelledError if the token is cancelled
+    void ThrowIfCancelled() const;
+
+private:
+    friend class CancellationSource;
+
+    std::shared_ptr<const std::atomic<bool>> is_cancelled_;
+    std::optional<std::chrono::steady_clock::time_point> deadline_;
+};
+
+// Cancels all of its tokens at once, from any thread
+class CancellationSource {
+public:
+    CancellationSource();
+
+    CancellationToken GetToken() const;
+
+    void Cancel();
+
+private:
+    std::shared_ptr<std::atomic<bool>> is_cancelled_;
+};
@@ -1,56 +1,369 @@
-#include <cstdlib>
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <execution>
+#include <iterator>
 #include <map>
-#include <mutex>
-#include <string>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
- 
-using namespace std::string_literals;
- 
+
+// Map of integer keys updated from many threads. Keys are spread over shards padded to
+// separate cache lines, every shard is a chain of open-addressing tables: a full table is
+// sealed and new keys go to the next one, twice as large, so a key never moves.
+// operator[] locks only the slot of the key while the returned Access lives. Add updates
+// arithmetic values with atomic operations, waiting only for such a slot lock.
 template <typename Key, typename Value>
 class ConcurrentMap {
 private:
-    struct Bucket {
-        std::mutex mutex;
-        std::map<Key, Value> map;
+    struct Slot;
+
+    // Exclusive lock of a slot
+    class SlotGuard {
+    public:
+        explicit SlotGuard(Slot& slot);
+
+        SlotGuard(const SlotGuard&) = delete;
+
+        SlotGuard& operator=(const SlotGuard&) = delete;
+
+        ~SlotGuard();
+
+    private:
+        Slot& slot_;
     };
- 
+
 public:
-    static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys"s);
- 
+    static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys");
+
     struct Access {
-        std::lock_guard<std::mutex> guard;
+        explicit Access(Slot& slot);
+
+        SlotGuard guard;
         Value& ref_to_value;
- 
-        Access(const Key& key, Bucket& bucket)
-            : guard(bucket.mutex)
-            , ref_to_value(bucket.map[key]) {
+    };
+
+    // Number of keys expected in total sets the initial size of the tables
+    explicit ConcurrentMap(size_t shard_count, size_t expected_size = 0);
+
+    ConcurrentMap(const ConcurrentMap&) = delete;
+
+    ConcurrentMap& operator=(const ConcurrentMap&) = delete;
+
+    // Inserts a default value if the key is missing
+    Access operator[](const Key& key);
+
+    // Inserts a zero value if the key is missing
+    template <typename T = Value, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+    void Add(const Key& key, Value delta);
+
+    void Erase(const Key& key);
+
+    // Items sorted by key. Shards are collected and sorted in parallel, then merged.
+    std::vector<std::pair<Key, Value>> Extract() const;
+
+    std::map<Key, Value> BuildOrdinaryMap() const;
+
+private:
+    enum SlotState : uint8_t {
+        EMPTY,
+        // The key is being written by the thread which claimed the slot
+        CLAIMED,
+        OCCUPIED,
+        // Was empty when the table was sealed, ends probing like EMPTY but can not be claimed
+        SEALED,
+    };
+
+    static const uint32_t EXCLUSIVE = UINT32_MAX;
+
+    struct Slot {
+        std::atomic<SlotState> state{EMPTY};
+        // EXCLUSIVE while the slot is locked, otherwise the number of running Adds
+        std::atomic<uint32_t> guard{0};
+        std::atomic<bool> is_erased{false};
+        Key key{};
+        Value value{};
+    };
+
+    struct Table {
+        explicit Table(size_t capacity)
+            : slots(new Slot[capacity])
+            , mask(capacity - 1) {
         }
+
+        std::unique_ptr<Slot[]> slots;
+        size_t mask;
+        std::atomic<size_t> size{0};
+        // Set by the only thread which allocates the next table
+        std::atomic<bool> is_growing{false};
+        std::atomic<Table*> next{nullptr};
     };
- 
-    explicit ConcurrentMap(size_t bucket_count)
-        : buckets_(bucket_count) {
+
+    struct alignas(64) Shard {
+        Shard() = default;
+
+        Shard(const Shard&) = delete;
+
+        ~Shard();
+
+        std::atomic<Table*> first{nullptr};
+    };
+
+    static const size_t MIN_TABLE_CAPACITY = 16;
+
+    std::vector<Shard> shards_;
+
+    Slot& FindOrInsert(const Key& key);
+
+    static size_t Hash(const Key& key);
+
+    // Returns the slot of the key in the table, nullptr if the key is not in the table.
+    // With is_inserting a missing key is inserted unless the table is sealed or full,
+    // then the next table is being allocated.
+    static Slot* FindSlot(Table& table, const Key& key, bool is_inserting);
+
+    static void Grow(Table& table);
+
+    // Waits until the thread growing the table publishes the next one
+    static Table& GetNextTable(Table& table);
+};
+
+template <typename Key, typename Value>
+ConcurrentMap<Key, Value>::SlotGuard::SlotGuard(Slot& slot)
+    : slot_(slot) {
+    uint32_t expected = 0;
+    while (!slot_.guard.compare_exchange_weak(expected, EXCLUSIVE, std::memory_order_acquire)) {
+        expected = 0;
+        std::this_thread::yield();
     }
- 
-    Access operator[](const Key& key) {
-        auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-        return {key, bucket};
+}
+
+template <typename Key, typename Value>
+ConcurrentMap<Key, Value>::SlotGuard::~SlotGuard() {
+    slot_.guard.store(0, std::memory_order_release);
+}
+
+template <typename Key, typename Value>
+ConcurrentMap<Key, Value>::Access::Access(Slot& slot)
+    : guard(slot)
+    , ref_to_value(slot.value) {
+    slot.is_erased.store(false, std::memory_order_relaxed);
+}
+
+template <typename Key, typename Value>
+ConcurrentMap<Key, Value>::Shard::~Shard() {
+    Table* table = first.load();
+    while (table) {
+        Table* next = table->next.load();
+        delete table;
+        table = next;
     }
+}
 
-    void Erase(const Key& key) {
-        auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-        std::lock_guard g(bucket.mutex);
-        bucket.map.erase(key);
+template <typename Key, typename Value>
+ConcurrentMap<Key, Value>::ConcurrentMap(size_t shard_count, size_t expected_size)
+    : shards_(std::max<size_t>(shard_count, 1)) {
+    size_t capacity = MIN_TABLE_CAPACITY;
+    // Tables are sealed at 3/4 of the capacity
+    while (capacity * 3 / 4 < expected_size / shards_.size()) {
+        capacity *= 2;
     }
- 
-    std::map<Key, Value> BuildOrdinaryMap() {
-        std::map<Key, Value> result;
-        for (auto& [mutex, map] : buckets_) {
-            std::lock_guard g(mutex);
-            result.insert(map.begin(), map.end());
+    for (Shard& shard : shards_) {
+        shard.first.store(new Table(capacity));
+    }
+}
+
+template <typename Key, typename Value>
+typename ConcurrentMap<Key, Value>::Access ConcurrentMap<Key, Value>::operator[](
+    const Key& key) {
+    return Access(FindOrInsert(key));
+}
+
+template <typename Key, typename Value>
+template <typename T, std::enable_if_t<std::is_arithmetic_v<T>, int>>
+void ConcurrentMap<Key, Value>::Add(const Key& key, Value delta) {
+    Slot& slot = FindOrInsert(key);
+    // Adds run together, an Access waits for them to finish
+    uint32_t guard = slot.guard.load(std::memory_order_relaxed);
+    while (guard == EXCLUSIVE
+           || !slot.guard.compare_exchange_weak(guard, guard + 1, std::memory_order_acquire)) {
+        if (guard == EXCLUSIVE) {
+            std::this_thread::yield();
+            guard = slot.guard.load(std::memory_order_relaxed);
         }
-        return result;
     }
- 
-private:
-    std::vector<Bucket> buckets_;
-};
+    slot.is_erased.store(false, std::memory_order_relaxed);
+    if constexpr (std::is_integral_v<Value>) {
+        __atomic_fetch_add(&slot.value, delta, __ATOMIC_RELAXED);
+    } else {
+        Value expected;
+        __atomic_load(&slot.value, &expected, __ATOMIC_RELAXED);
+        Value desired = expected + delta;
+        while (!__atomic_compare_exchange(&slot.value, &expected, &desired, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            desired = expected + delta;
+        }
+    }
+    slot.guard.fetch_sub(1, std::memory_order_release);
+}
+
+template <typename Key, typename Value>
+void ConcurrentMap<Key, Value>::Erase(const Key& key) {
+    Shard& shard = shards_[static_cast<uint64_t>(key) % shards_.size()];
+    for (Table* table = shard.first.load(std::memory_order_acquire); table;
+         table = table->next.load(std::memory_order_acquire)) {
+        if (Slot* slot = FindSlot(*table, key, false)) {
+            // The slot keeps the key, it is skipped until the key is accessed again
+            SlotGuard guard(*slot);
+            slot->is_erased.store(true, std::memory_order_relaxed);
+            slot->value = Value{};
+            return;
+        }
+    }
+}
+
+template <typename Key, typename Value>
+std::vector<std::pair<Key, Value>> ConcurrentMap<Key, Value>::Extract() const {
+    std::vector<std::vector<std::pair<Key, Value>>> shard_items(shards_.size());
+    std::transform(std::execution::par, shards_.begin(), shards_.end(), shard_items.begin(),
+        [](const Shard& shard) {
+            std::vector<std::pair<Key, Value>> items;
+            for (Table* table = shard.first.load(std::memory_order_acquire); table;
+                 table = table->next.load(std::memory_order_acquire)) {
+                for (size_t i = 0; i <= table->mask; ++i) {
+                    Slot& slot = table->slots[i];
+                    if (slot.state.load(std::memory_order_acquire) != OCCUPIED) {
+                        continue;
+                    }
+                    SlotGuard guard(slot);
+                    if (!slot.is_erased.load(std::memory_order_relaxed)) {
+                        items.push_back({slot.key, slot.value});
+                    }
+                }
+            }
+            std::sort(items.begin(), items.end(), [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+            });
+            return items;
+        });
+
+    // Sorted shards are merged pairwise, the merges of a round run in parallel
+    while (shard_items.size() > 1) {
+        std::vector<std::vector<std::pair<Key, Value>>> merged((shard_items.size() + 1) / 2);
+        std::vector<size_t> indexes(merged.size());
+        std::iota(indexes.begin(), indexes.end(), 0);
+        std::for_each(std::execution::par, indexes.begin(), indexes.end(),
+            [&shard_items, &merged](size_t i) {
+                if (2 * i + 1 == shard_items.size()) {
+                    merged[i] = std::move(shard_items[2 * i]);
+                    return;
+                }
+                auto& lhs = shard_items[2 * i];
+                auto& rhs = shard_items[2 * i + 1];
+                merged[i].reserve(lhs.size() + rhs.size());
+                std::merge(std::make_move_iterator(lhs.begin()),
+                           std::make_move_iterator(lhs.end()),
+                           std::make_move_iterator(rhs.begin()),
+                           std::make_move_iterator(rhs.end()), std::back_inserter(merged[i]),
+                           [](const auto& lhs_item, const auto& rhs_item) {
+                               return lhs_item.first < rhs_item.first;
+                           });
+            });
+        shard_items = std::move(merged);
+    }
+    return shard_items.empty() ? std::vector<std::pair<Key, Value>>{} : std::move(shard_items[0]);
+}
+
+template <typename Key, typename Value>
+std::map<Key, Value> ConcurrentMap<Key, Value>::BuildOrdinaryMap() const {
+    std::map<Key, Value> result;
+    for (auto& item : Extract()) {
+        result.emplace_hint(result.end(), std::move(item));
+    }
+    return result;
+}
+
+template <typename Key, typename Value>
+typename ConcurrentMap<Key, Value>::Slot& ConcurrentMap<Key, Value>::FindOrInsert(
+    const Key& key) {
+    Shard& shard = shards_[static_cast<uint64_t>(key) % shards_.size()];
+    Table* table = shard.first.load(std::memory_order_acquire);
+    while (true) {
+        if (Slot* slot = FindSlot(*table, key, true)) {
+            return *slot;
+        }
+        table = &GetNextTable(*table);
+    }
+}
+
+template <typename Key, typename Value>
+size_t ConcurrentMap<Key, Value>::Hash(const Key& key) {
+    // Fibonacci hashing, keys of a shard share the remainder of the division
+    return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+template <typename Key, typename Value>
+typename ConcurrentMap<Key, Value>::Slot* ConcurrentMap<Key, Value>::FindSlot(
+    Table& table, const Key& key, bool is_inserting) {
+    size_t i = Hash(key) & table.mask;
+    for (size_t probe = 0; probe <= table.mask; ++probe, i = (i + 1) & table.mask) {
+        Slot& slot = table.slots[i];
+        SlotState state = slot.state.load(std::memory_order_acquire);
+        if (state == EMPTY && is_inserting) {
+            if (slot.state.compare_exchange_strong(state, CLAIMED, std::memory_order_acquire)) {
+                slot.key = key;
+                slot.state.store(OCCUPIED, std::memory_order_release);
+                if ((table.size.fetch_add(1, std::memory_order_relaxed) + 1) * 4
+                    > (table.mask + 1) * 3) {
+                    Grow(table);
+                }
+                return &slot;
+            }
+            // Claimed by another thread or sealed meanwhile
+        }
+        while (state == CLAIMED) {
+            state = slot.state.load(std::memory_order_acquire);
+        }
+        if (state == EMPTY || state == SEALED) {
+            return nullptr;
+        }
+        if (slot.key == key) {
+            return &slot;
+        }
+    }
+    // Filled up by concurrent inserts before it was sealed
+    if (is_inserting) {
+        Grow(table);
+    }
+    return nullptr;
+}
+
+template <typename Key, typename Value>
+void ConcurrentMap<Key, Value>::Grow(Table& table) {
+    // The resize is claimed before anything is allocated
+    bool is_growing = false;
+    if (!table.is_growing.compare_exchange_strong(is_growing, true, std::memory_order_acq_rel)) {
+        return;
+    }
+    table.next.store(new Table((table.mask + 1) * 2), std::memory_order_release);
+    // A key missing in a sealed table is inserted into the next one
+    for (size_t i = 0; i <= table.mask; ++i) {
+        SlotState expected = EMPTY;
+        table.slots[i].state.compare_exchange_strong(expected, SEALED, std::memory_order_acq_rel);
+    }
+}
+
+template <typename Key, typename Value>
+typename ConcurrentMap<Key, Value>::Table& ConcurrentMap<Key, Value>::GetNextTable(
+    Table& table) {
+    Table* next = table.next.load(std::memory_order_acquire);
+    while (next == nullptr) {
+        std::this_thread::yield();
+        next = table.next.load(std::memory_order_acquire);
+    }
+    return *next;
+}
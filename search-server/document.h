@@ -1,5 +1,6 @@
 #pragma once
 #include <iostream>
+#include <string_view>
 #include <vector>
 
 struct Document {
@@ -21,6 +22,16 @@ enum class DocumentStatus {
     REMOVED,
 };
 
+// Document passed to SearchServer::AddDocuments
+struct DocumentInput {
+    int id = 0;
+    // Not owned, the text has to outlive the AddDocuments call. Building it from a
+    // temporary std::string leaves it dangling once the full expression ends.
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
 std::ostream& operator<<(std::ostream& out, const Document& document);
 
 void PrintMatchDocumentResult(int document_id, std::vector<std::string_view> words,
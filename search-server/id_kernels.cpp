@@ -0,0 +1,266 @@
+#include "id_kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ID_KERNELS_X86
+#endif
+
+using namespace std;
+
+namespace {
+
+// Arrays whose sizes differ more than this are merged by galloping through the larger one
+const size_t GALLOP_SIZE_RATIO = 32;
+
+// Merges from positions i and j on. Ids of rhs before j have to be less than lhs[i].
+template <bool keep_found>
+size_t MergeScalar(const uint32_t* lhs, size_t lhs_size, size_t i, const uint32_t* rhs,
+                   size_t rhs_size, size_t j, uint32_t* out, size_t count) {
+    for (; i < lhs_size; ++i) {
+        while (j < rhs_size && rhs[j] < lhs[i]) {
+            ++j;
+        }
+        const bool is_found = j < rhs_size && rhs[j] == lhs[i];
+        if (is_found == keep_found) {
+            out[count++] = lhs[i];
+        }
+    }
+    return count;
+}
+
+template <bool keep_found>
+size_t MergeGalloping(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out) {
+    size_t count = 0;
+    size_t j = 0;
+    for (uint32_t id : lhs) {
+        j = GallopIds(rhs, j, id);
+        const bool is_found = j < rhs.size() && rhs[j] == id;
+        if (is_found == keep_found) {
+            out[count++] = id;
+        }
+    }
+    return count;
+}
+
+#ifdef ID_KERNELS_X86
+
+// Shuffles packing the lanes selected by a mask to the front of a vector
+struct PackTables {
+    alignas(16) array<array<uint8_t, 16>, 16> sse;
+    alignas(32) array<array<uint32_t, 8>, 256> avx2;
+
+    PackTables() {
+        for (int mask = 0; mask < 16; ++mask) {
+            sse[mask].fill(0x80);
+            int lane_count = 0;
+            for (int lane = 0; lane < 4; ++lane) {
+                if (mask & (1 << lane)) {
+                    for (int byte = 0; byte < 4; ++byte) {
+                        sse[mask][lane_count * 4 + byte] = static_cast<uint8_t>(lane * 4 + byte);
+                    }
+                    ++lane_count;
+                }
+            }
+        }
+        for (int mask = 0; mask < 256; ++mask) {
+            avx2[mask].fill(0);
+            int lane_count = 0;
+            for (int lane = 0; lane < 8; ++lane) {
+                if (mask & (1 << lane)) {
+                    avx2[mask][lane_count++] = static_cast<uint32_t>(lane);
+                }
+            }
+        }
+    }
+};
+
+const PackTables PACK_TABLES;
+
+// Lanes of a which are equal to any lane of b
+__attribute__((target("sse4.1")))
+__m128i FindInBlockSse41(__m128i a, __m128i b) {
+    __m128i found = _mm_cmpeq_epi32(a, b);
+    found = _mm_or_si128(found, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 3, 2, 1))));
+    found = _mm_or_si128(found, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2))));
+    found = _mm_or_si128(found, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(2, 1, 0, 3))));
+    return found;
+}
+
+// Every block of lhs is compared with all blocks of rhs which overlap it, then the lanes
+// of lhs selected by the result are packed to the output
+template <bool keep_found>
+__attribute__((target("sse4.1")))
+size_t MergeSse41(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out) {
+    const uint32_t* lhs_ids = lhs.data();
+    const uint32_t* rhs_ids = rhs.data();
+    size_t i = 0;
+    size_t j = 0;
+    size_t count = 0;
+    while (i + 4 <= lhs.size() && j + 4 <= rhs.size()) {
+        const __m128i lhs_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs_ids + i));
+        const uint32_t lhs_last = lhs_ids[i + 3];
+        const size_t first_j = j;
+        __m128i found = _mm_setzero_si128();
+        while (true) {
+            const __m128i rhs_block =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs_ids + j));
+            found = _mm_or_si128(found, FindInBlockSse41(lhs_block, rhs_block));
+            // A block reaching past lhs_last is needed for the next lhs block as well
+            if (rhs_ids[j + 3] >= lhs_last || j + 8 > rhs.size()) {
+                break;
+            }
+            j += 4;
+        }
+        if (rhs_ids[j + 3] < lhs_last) {
+            // The tail of rhs is shorter than a block, the scalar merge finishes
+            j = first_j;
+            break;
+        }
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(found));
+        if (!keep_found) {
+            mask ^= 0xF;
+        }
+        const __m128i packed = _mm_shuffle_epi8(
+            lhs_block, _mm_load_si128(reinterpret_cast<const __m128i*>(PACK_TABLES.sse[mask].data())));
+        alignas(16) uint32_t packed_ids[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(packed_ids), packed);
+        const int packed_count = __builtin_popcount(mask);
+        memcpy(out + count, packed_ids, packed_count * sizeof(uint32_t));
+        count += packed_count;
+        i += 4;
+    }
+    return MergeScalar<keep_found>(lhs_ids, lhs.size(), i, rhs_ids, rhs.size(), j, out, count);
+}
+
+__attribute__((target("avx2")))
+__m256i FindInBlockAvx2(__m256i a, __m256i b) {
+    __m256i found = _mm256_cmpeq_epi32(a, b);
+    for (int shift = 1; shift < 8; ++shift) {
+        const __m256i rotation = _mm256_setr_epi32(shift, (shift + 1) % 8, (shift + 2) % 8,
+                                                   (shift + 3) % 8, (shift + 4) % 8,
+                                                   (shift + 5) % 8, (shift + 6) % 8,
+                                                   (shift + 7) % 8);
+        found = _mm256_or_si256(
+            found, _mm256_cmpeq_epi32(a, _mm256_permutevar8x32_epi32(b, rotation)));
+    }
+    return found;
+}
+
+template <bool keep_found>
+__attribute__((target("avx2")))
+size_t MergeAvx2(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out) {
+    const uint32_t* lhs_ids = lhs.data();
+    const uint32_t* rhs_ids = rhs.data();
+    size_t i = 0;
+    size_t j = 0;
+    size_t count = 0;
+    while (i + 8 <= lhs.size() && j + 8 <= rhs.size()) {
+        const __m256i lhs_block =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs_ids + i));
+        const uint32_t lhs_last = lhs_ids[i + 7];
+        const size_t first_j = j;
+        __m256i found = _mm256_setzero_si256();
+        while (true) {
+            const __m256i rhs_block =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs_ids + j));
+            found = _mm256_or_si256(found, FindInBlockAvx2(lhs_block, rhs_block));
+            if (rhs_ids[j + 7] >= lhs_last || j + 16 > rhs.size()) {
+                break;
+            }
+            j += 8;
+        }
+        if (rhs_ids[j + 7] < lhs_last) {
+            j = first_j;
+            break;
+        }
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(found));
+        if (!keep_found) {
+            mask ^= 0xFF;
+        }
+        const __m256i shuffle = _mm256_load_si256(
+            reinterpret_cast<const __m256i*>(PACK_TABLES.avx2[mask].data()));
+        alignas(32) uint32_t packed_ids[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(packed_ids),
+                           _mm256_permutevar8x32_epi32(lhs_block, shuffle));
+        const int packed_count = __builtin_popcount(mask);
+        memcpy(out + count, packed_ids, packed_count * sizeof(uint32_t));
+        count += packed_count;
+        i += 8;
+    }
+    return MergeScalar<keep_found>(lhs_ids, lhs.size(), i, rhs_ids, rhs.size(), j, out, count);
+}
+
+#endif
+
+template <bool keep_found>
+size_t Merge(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out,
+             IdKernels kernels) {
+    if (rhs.size() > GALLOP_SIZE_RATIO * lhs.size()) {
+        return MergeGalloping<keep_found>(lhs, rhs, out);
+    }
+    switch (kernels) {
+#ifdef ID_KERNELS_X86
+    case IdKernels::AVX2:
+        return MergeAvx2<keep_found>(lhs, rhs, out);
+    case IdKernels::SSE41:
+        return MergeSse41<keep_found>(lhs, rhs, out);
+#endif
+    default:
+        return MergeScalar<keep_found>(lhs.data(), lhs.size(), 0, rhs.data(), rhs.size(), 0,
+                                       out, 0);
+    }
+}
+
+}  // namespace
+
+IdKernels GetSupportedIdKernels() {
+#ifdef ID_KERNELS_X86
+    static const IdKernels kernels = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return IdKernels::AVX2;
+        }
+        return __builtin_cpu_supports("sse4.1") ? IdKernels::SSE41 : IdKernels::SCALAR;
+    }();
+    return kernels;
+#else
+    return IdKernels::SCALAR;
+#endif
+}
+
+size_t IntersectIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out) {
+    return IntersectIds(lhs, rhs, out, GetSupportedIdKernels());
+}
+
+size_t IntersectIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out,
+                    IdKernels kernels) {
+    return Merge<true>(lhs, rhs, out, kernels);
+}
+
+size_t SubtractIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out) {
+    return SubtractIds(lhs, rhs, out, GetSupportedIdKernels());
+}
+
+size_t SubtractIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out,
+                   IdKernels kernels) {
+    return Merge<false>(lhs, rhs, out, kernels);
+}
+
+size_t GallopIds(ArrayView<uint32_t> ids, size_t begin, uint32_t id) {
+    if (begin >= ids.size() || ids[begin] >= id) {
+        return begin;
+    }
+    // ids[low] < id
+    size_t low = begin;
+    size_t step = 1;
+    while (low + step < ids.size() && ids[low + step] < id) {
+        low += step;
+        step *= 2;
+    }
+    const size_t high = min(low + step, ids.size());
+    return lower_bound(ids.begin() + low + 1, ids.begin() + high, id) - ids.begin();
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "array_view.h"
+
+// Kernels over ascending arrays of unique 32-bit ids, such as decoded posting lists.
+// Vector versions are chosen at runtime by the features of the processor.
+enum class IdKernels {
+    SCALAR,
+    SSE41,
+    AVX2,
+};
+
+// Best kernels supported by the processor
+IdKernels GetSupportedIdKernels();
+
+// Writes the ids of lhs which are in rhs to out and returns their number.
+// Out needs room for lhs.size() ids and may be lhs.data().
+size_t IntersectIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out);
+
+// The kernels have to be supported by the processor
+size_t IntersectIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out,
+                    IdKernels kernels);
+
+// Writes the ids of lhs which are not in rhs to out and returns their number.
+// Out needs room for lhs.size() ids and may be lhs.data().
+size_t SubtractIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out);
+
+size_t SubtractIds(ArrayView<uint32_t> lhs, ArrayView<uint32_t> rhs, uint32_t* out,
+                   IdKernels kernels);
+
+// Returns the first index from begin on with ids[index] >= id, ids.size() if there is none.
+// Steps of growing length go before the binary search, so the cost depends on the
+// distance from begin rather than on the size of the array.
+size_t GallopIds(ArrayView<uint32_t> ids, size_t begin, uint32_t id);
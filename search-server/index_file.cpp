@@ -0,0 +1,153 @@
+#include "index_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char INDEX_FILE_MAGIC[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+static const size_t SECTION_ALIGNMENT = 8;
+
+// Flushes a file or a directory to disk
+static bool SyncPath(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool is_synced = fsync(fd) == 0;
+    close(fd);
+    return is_synced;
+}
+
+IndexFileWriter::IndexFileWriter(const string& path, int first_ordinal,
+                                 uint64_t log_sequence_number)
+    : path_(path)
+    , temporary_path_(path + ".tmp"s)
+    , out_(temporary_path_, ios::binary | ios::trunc) {
+    if (!out_) {
+        throw runtime_error("Can not create index file "s + temporary_path_);
+    }
+    memcpy(header_.magic, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC));
+    header_.version = INDEX_FILE_VERSION;
+    header_.byte_order_mark = 1;
+    header_.first_ordinal = first_ordinal;
+    header_.section_count = static_cast<uint32_t>(IndexSection::COUNT);
+    header_.log_sequence_number = log_sequence_number;
+    // The header is rewritten with section locations in Finish
+    out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+}
+
+void IndexFileWriter::WriteStrings(IndexSection offsets_section, IndexSection text_section,
+                                   const vector<string_view>& strings) {
+    vector<uint64_t> offsets;
+    offsets.reserve(strings.size() + 1);
+    string text;
+    for (string_view str : strings) {
+        offsets.push_back(text.size());
+        text += str;
+    }
+    offsets.push_back(text.size());
+    WriteSection<uint64_t>(offsets_section, offsets);
+    WriteBytes(text_section, text.data(), text.size());
+}
+
+void IndexFileWriter::Finish() {
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    out_.close();
+    if (!out_ || !SyncPath(temporary_path_)) {
+        throw runtime_error("Can not write index file "s + temporary_path_);
+    }
+    if (rename(temporary_path_.c_str(), path_.c_str()) != 0) {
+        throw runtime_error("Can not replace index file "s + path_);
+    }
+    // The rename is durable only once the directory entry is on disk
+    const filesystem::path directory = filesystem::path(path_).parent_path();
+    if (!SyncPath(directory.empty() ? "."s : directory.string())) {
+        throw runtime_error("Can not sync the directory of index file "s + path_);
+    }
+}
+
+void IndexFileWriter::WriteBytes(IndexSection section, const char* data, size_t size) {
+    static const char padding[SECTION_ALIGNMENT] = {};
+    const uint64_t position = static_cast<uint64_t>(out_.tellp());
+    const uint64_t offset = (position + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT
+                            * SECTION_ALIGNMENT;
+    out_.write(padding, offset - position);
+    out_.write(data, size);
+    header_.sections[static_cast<size_t>(section)] = {offset, size};
+}
+
+IndexFile::IndexFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Can not open index file "s + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0
+        || static_cast<size_t>(file_stat.st_size) < sizeof(IndexFileHeader)) {
+        close(fd);
+        throw runtime_error("Invalid index file "s + path);
+    }
+    size_ = file_stat.st_size;
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw runtime_error("Can not map index file "s + path);
+    }
+    data_ = static_cast<const char*>(data);
+
+    const IndexFileHeader& header = GetHeader();
+    bool is_valid = memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC)) == 0
+                    && header.version == INDEX_FILE_VERSION && header.byte_order_mark == 1
+                    && header.section_count == static_cast<uint32_t>(IndexSection::COUNT);
+    for (const auto& section : header.sections) {
+        is_valid = is_valid && section.offset % SECTION_ALIGNMENT == 0
+                   && section.offset <= size_ && section.size <= size_ - section.offset;
+    }
+    if (!is_valid) {
+        munmap(const_cast<char*>(data_), size_);
+        throw runtime_error("Invalid index file "s + path);
+    }
+}
+
+IndexFile::~IndexFile() {
+    munmap(const_cast<char*>(data_), size_);
+}
+
+int IndexFile::GetFirstOrdinal() const {
+    return GetHeader().first_ordinal;
+}
+
+uint64_t IndexFile::GetLogSequenceNumber() const {
+    return GetHeader().log_sequence_number;
+}
+
+vector<string_view> IndexFile::GetStrings(IndexSection offsets_section,
+                                          IndexSection text_section) const {
+    const ArrayView<uint64_t> offsets = GetSection<uint64_t>(offsets_section);
+    const ArrayView<char> text = GetSection<char>(text_section);
+    vector<string_view> strings;
+    if (offsets.empty()) {
+        return strings;
+    }
+    strings.reserve(offsets.size() - 1);
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+        if (offsets[i] > offsets[i + 1] || offsets[i + 1] > text.size()) {
+            throw runtime_error("Invalid strings in index file"s);
+        }
+        strings.emplace_back(text.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+    return strings;
+}
+
+const IndexFileHeader& IndexFile::GetHeader() const {
+    return *reinterpret_cast<const IndexFileHeader*>(data_);
+}
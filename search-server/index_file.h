@@ -0,0 +1,127 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "array_view.h"
+
+using namespace std::string_literals;
+
+// The index file starts with IndexFileHeader followed by sections. Every section is an
+// array of fixed-size items in the byte order of the writing machine, aligned to 8 bytes,
+// so a mapped file is used in place.
+enum class IndexSection : uint32_t {
+    STOP_WORD_OFFSETS,
+    STOP_WORD_TEXT,
+    TERM_OFFSETS,
+    TERM_TEXT,
+    DOCUMENT_IDS,
+    DOCUMENT_RATINGS,
+    DOCUMENT_STATUSES,
+    DOCUMENT_INV_WORD_COUNTS,
+    ID_TO_ORDINAL,
+    POSTING_TERM_IDS,
+    POSTING_TERM_BLOCK_OFFSETS,
+    POSTING_TERM_DOCUMENT_COUNTS,
+    POSTING_TERM_MAX_TERM_FREQS,
+    POSTING_BLOCKS,
+    POSTING_BYTES,
+    WORD_FREQ_OFFSETS,
+    WORD_FREQ_TERM_IDS,
+    WORD_FREQ_VALUES,
+    COUNT,
+};
+
+const uint32_t INDEX_FILE_VERSION = 3;
+
+struct IndexFileHeader {
+    struct Section {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    char magic[8];
+    uint32_t version;
+    // Written as 1, detects files of machines with other byte order
+    uint32_t byte_order_mark;
+    int32_t first_ordinal;
+    uint32_t section_count;
+    // Last mutation of the write-ahead log included in the index
+    uint64_t log_sequence_number;
+    Section sections[static_cast<size_t>(IndexSection::COUNT)];
+};
+
+// Writes a new index file. Sections go to a temporary file which replaces the target in
+// Finish, so processes which mapped the previous version keep using it.
+class IndexFileWriter {
+public:
+    IndexFileWriter(const std::string& path, int first_ordinal, uint64_t log_sequence_number);
+
+    template <typename T>
+    void WriteSection(IndexSection section, ArrayView<T> items);
+
+    // Writes strings as an array of offsets into concatenated text
+    void WriteStrings(IndexSection offsets_section, IndexSection text_section,
+                      const std::vector<std::string_view>& strings);
+
+    // Returns once the file and its new name are on disk
+    void Finish();
+
+private:
+    std::string path_;
+    std::string temporary_path_;
+    std::ofstream out_;
+    IndexFileHeader header_ = {};
+
+    void WriteBytes(IndexSection section, const char* data, size_t size);
+};
+
+// Index file mapped into memory read-only. Pages are loaded on first access and are
+// shared with other processes mapping the same file.
+class IndexFile {
+public:
+    // Throws std::runtime_error if the file can not be mapped or has an unknown format
+    explicit IndexFile(const std::string& path);
+
+    IndexFile(const IndexFile&) = delete;
+
+    IndexFile& operator=(const IndexFile&) = delete;
+
+    ~IndexFile();
+
+    int GetFirstOrdinal() const;
+
+    uint64_t GetLogSequenceNumber() const;
+
+    template <typename T>
+    ArrayView<T> GetSection(IndexSection section) const;
+
+    // Views point into the mapping
+    std::vector<std::string_view> GetStrings(IndexSection offsets_section,
+                                             IndexSection text_section) const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+    const IndexFileHeader& GetHeader() const;
+};
+
+template <typename T>
+void IndexFileWriter::WriteSection(IndexSection section, ArrayView<T> items) {
+    WriteBytes(section, reinterpret_cast<const char*>(items.data()), items.size() * sizeof(T));
+}
+
+template <typename T>
+ArrayView<T> IndexFile::GetSection(IndexSection section) const {
+    const IndexFileHeader::Section& location =
+        GetHeader().sections[static_cast<size_t>(section)];
+    if (location.size % sizeof(T) != 0) {
+        throw std::runtime_error("Invalid size of an index file section"s);
+    }
+    return {reinterpret_cast<const T*>(data_ + location.offset), location.size / sizeof(T)};
+}
@@ -0,0 +1,425 @@
+#include "index_segment.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+using namespace std;
+
+// ReadVarint of PostingListView which fails instead of reading past the end
+static bool ReadCheckedVarint(const uint8_t*& data, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && data != end; shift += 7) {
+        value |= static_cast<uint32_t>(*data & 0x7F) << shift;
+        if ((*data++ & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DocumentTable::PushBack(int id, int rating, DocumentStatus status, double inv_word_count) {
+    ids.push_back(id);
+    ratings.push_back(rating);
+    statuses.push_back(status);
+    inv_word_counts.push_back(inv_word_count);
+}
+
+DocumentColumns DocumentTable::GetColumns() const {
+    return {ids, ratings, statuses, inv_word_counts};
+}
+
+IndexSegment::IndexSegment(int first_ordinal)
+    : first_ordinal_(first_ordinal) {
+}
+
+int IndexSegment::GetFirstOrdinal() const {
+    return first_ordinal_;
+}
+
+int IndexSegment::GetOrdinalEnd() const {
+    return first_ordinal_ + static_cast<int>(GetDocuments().ids.size());
+}
+
+int IndexSegment::FindOrdinal(int document_id) const {
+    const ArrayView<pair<int, int>> id_to_ordinal = GetIdIndex();
+    auto it = lower_bound(id_to_ordinal.begin(), id_to_ordinal.end(),
+                          pair{document_id, numeric_limits<int>::min()});
+    if (it == id_to_ordinal.end() || it->first != document_id || IsRemoved(it->second)) {
+        return -1;
+    }
+    return it->second;
+}
+
+MutableSegment::MutableSegment(int first_ordinal)
+    : IndexSegment(first_ordinal) {
+}
+
+int MutableSegment::AddDocument(int document_id, DocumentStatus status, int rating,
+                                double inv_word_count,
+                                const vector<pair<TermId, uint32_t>>& term_counts) {
+    const int ordinal = GetOrdinalEnd();
+    for (const auto& [term_id, term_count] : term_counts) {
+        // Ordinals grow, so the posting always goes to the tail of the list
+        GetWritablePostings(term_id).Insert(ordinal, term_count, term_count * inv_word_count);
+    }
+    id_to_ordinal_.insert(lower_bound(id_to_ordinal_.begin(), id_to_ordinal_.end(),
+                                      pair{document_id, ordinal}),
+                          {document_id, ordinal});
+    documents_.PushBack(document_id, rating, status, inv_word_count);
+    is_removed_.push_back(false);
+    return ordinal;
+}
+
+void MutableSegment::RemoveDocument(int ordinal, const vector<TermId>& term_ids) {
+    for (TermId term_id : term_ids) {
+        PostingList& postings = GetWritablePostings(term_id);
+        postings.Erase(ordinal);
+        if (postings.empty()) {
+            term_postings_.erase(lower_bound(term_postings_.begin(), term_postings_.end(),
+                                             term_id, [](const auto& entry, TermId value) {
+                                                 return entry.first < value;
+                                             }));
+        }
+    }
+    const int document_id = documents_.ids[ordinal - first_ordinal_];
+    id_to_ordinal_.erase(lower_bound(id_to_ordinal_.begin(), id_to_ordinal_.end(),
+                                     pair{document_id, ordinal}));
+    is_removed_[ordinal - first_ordinal_] = true;
+}
+
+int MutableSegment::GetDocumentCount() const {
+    return static_cast<int>(documents_.ids.size());
+}
+
+DocumentColumns MutableSegment::GetDocuments() const {
+    return documents_.GetColumns();
+}
+
+PostingListView MutableSegment::GetPostings(TermId term_id) const {
+    auto it = lower_bound(term_postings_.begin(), term_postings_.end(), term_id,
+                          [](const auto& entry, TermId value) {
+                              return entry.first < value;
+                          });
+    if (it == term_postings_.end() || it->first != term_id) {
+        return {};
+    }
+    return it->second->GetView();
+}
+
+vector<TermId> MutableSegment::GetTermIds() const {
+    vector<TermId> term_ids;
+    term_ids.reserve(term_postings_.size());
+    for (const auto& [term_id, _] : term_postings_) {
+        term_ids.push_back(term_id);
+    }
+    return term_ids;
+}
+
+bool MutableSegment::IsRemoved(int ordinal) const {
+    return is_removed_[ordinal - first_ordinal_];
+}
+
+ArrayView<pair<int, int>> MutableSegment::GetIdIndex() const {
+    return id_to_ordinal_;
+}
+
+PostingList& MutableSegment::GetWritablePostings(TermId term_id) {
+    auto it = lower_bound(term_postings_.begin(), term_postings_.end(), term_id,
+                          [](const auto& entry, TermId value) {
+                              return entry.first < value;
+                          });
+    if (it == term_postings_.end() || it->first != term_id) {
+        it = term_postings_.insert(it, {term_id, make_shared<PostingList>()});
+    } else if (it->second.use_count() > 1) {
+        // The list is shared with another copy of the segment, which may be in use
+        it->second = make_shared<PostingList>(*it->second);
+    }
+    return *it->second;
+}
+
+SealedSegment::SealedSegment(const vector<const IndexSegment*>& sources,
+                             const function<bool(int ordinal)>& is_removed)
+    : IndexSegment(sources.front()->GetFirstOrdinal()) {
+    DocumentTable& documents = storage_.documents;
+    vector<pair<int, int>>& id_to_ordinal = storage_.id_to_ordinal;
+    // New ordinals of source documents, -1 for removed ones
+    vector<vector<int>> new_ordinals(sources.size());
+    vector<TermId> term_ids;
+    for (size_t source_index = 0; source_index < sources.size(); ++source_index) {
+        const IndexSegment& source = *sources[source_index];
+        const DocumentColumns source_documents = source.GetDocuments();
+        for (size_t i = 0; i < source_documents.ids.size(); ++i) {
+            const int ordinal = source.GetFirstOrdinal() + static_cast<int>(i);
+            if (source.IsRemoved(ordinal) || is_removed(ordinal)) {
+                new_ordinals[source_index].push_back(-1);
+                continue;
+            }
+            const int new_ordinal = first_ordinal_ + static_cast<int>(documents.ids.size());
+            new_ordinals[source_index].push_back(new_ordinal);
+            id_to_ordinal.push_back({source_documents.ids[i], new_ordinal});
+            documents.PushBack(source_documents.ids[i], source_documents.ratings[i],
+                               source_documents.statuses[i], source_documents.inv_word_counts[i]);
+        }
+        const vector<TermId> source_term_ids = source.GetTermIds();
+        term_ids.insert(term_ids.end(), source_term_ids.begin(), source_term_ids.end());
+    }
+    sort(id_to_ordinal.begin(), id_to_ordinal.end());
+    sort(term_ids.begin(), term_ids.end());
+    term_ids.erase(unique(term_ids.begin(), term_ids.end()), term_ids.end());
+
+    vector<PostingBlock>& blocks = storage_.blocks;
+    vector<uint8_t>& bytes = storage_.bytes;
+    storage_.term_block_offsets.push_back(0);
+    for (TermId term_id : term_ids) {
+        const size_t first_block = blocks.size();
+        uint32_t document_count = 0;
+        for (size_t source_index = 0; source_index < sources.size(); ++source_index) {
+            const int source_first_ordinal = sources[source_index]->GetFirstOrdinal();
+            const vector<int>& source_new_ordinals = new_ordinals[source_index];
+            sources[source_index]->GetPostings(term_id).ForEach(
+                [&](int ordinal, uint32_t term_count) {
+                    const int new_ordinal = source_new_ordinals[ordinal - source_first_ordinal];
+                    if (new_ordinal >= 0) {
+                        const double inv_word_count =
+                            documents.inv_word_counts[new_ordinal - first_ordinal_];
+                        AppendPosting(blocks, first_block, bytes,
+                                      static_cast<uint32_t>(new_ordinal), term_count,
+                                      term_count * inv_word_count);
+                        ++document_count;
+                    }
+                });
+        }
+        if (document_count == 0) {
+            continue;
+        }
+        float max_term_freq = 0.0f;
+        for (size_t block_index = first_block; block_index < blocks.size(); ++block_index) {
+            max_term_freq = max(max_term_freq, blocks[block_index].max_term_freq);
+        }
+        storage_.term_ids.push_back(term_id);
+        storage_.term_block_offsets.push_back(static_cast<uint32_t>(blocks.size()));
+        storage_.term_document_counts.push_back(document_count);
+        storage_.term_max_term_freqs.push_back(max_term_freq);
+    }
+    blocks.shrink_to_fit();
+    bytes.shrink_to_fit();
+
+    documents_ = documents.GetColumns();
+    id_to_ordinal_ = id_to_ordinal;
+    term_ids_ = storage_.term_ids;
+    term_block_offsets_ = storage_.term_block_offsets;
+    term_document_counts_ = storage_.term_document_counts;
+    term_max_term_freqs_ = storage_.term_max_term_freqs;
+    blocks_ = blocks;
+    bytes_ = bytes;
+}
+
+SealedSegment::SealedSegment(shared_ptr<const IndexFile> file)
+    : IndexSegment(file->GetFirstOrdinal())
+    , file_(move(file)) {
+    documents_ = {file_->GetSection<int>(IndexSection::DOCUMENT_IDS),
+                  file_->GetSection<int>(IndexSection::DOCUMENT_RATINGS),
+                  file_->GetSection<DocumentStatus>(IndexSection::DOCUMENT_STATUSES),
+                  file_->GetSection<double>(IndexSection::DOCUMENT_INV_WORD_COUNTS)};
+    id_to_ordinal_ = file_->GetSection<pair<int, int>>(IndexSection::ID_TO_ORDINAL);
+    term_ids_ = file_->GetSection<TermId>(IndexSection::POSTING_TERM_IDS);
+    term_block_offsets_ = file_->GetSection<uint32_t>(IndexSection::POSTING_TERM_BLOCK_OFFSETS);
+    term_document_counts_ =
+        file_->GetSection<uint32_t>(IndexSection::POSTING_TERM_DOCUMENT_COUNTS);
+    term_max_term_freqs_ = file_->GetSection<float>(IndexSection::POSTING_TERM_MAX_TERM_FREQS);
+    blocks_ = file_->GetSection<PostingBlock>(IndexSection::POSTING_BLOCKS);
+    bytes_ = file_->GetSection<uint8_t>(IndexSection::POSTING_BYTES);
+
+    const size_t document_count = documents_.ids.size();
+    if (documents_.ratings.size() != document_count
+        || documents_.statuses.size() != document_count
+        || documents_.inv_word_counts.size() != document_count
+        || id_to_ordinal_.size() != document_count
+        || term_block_offsets_.size() != term_ids_.size() + 1
+        || term_document_counts_.size() != term_ids_.size()
+        || term_max_term_freqs_.size() != term_ids_.size()
+        || term_block_offsets_[term_ids_.size()] != blocks_.size()
+        || first_ordinal_ < 0
+        || document_count > static_cast<size_t>(numeric_limits<int>::max() - first_ordinal_)) {
+        throw runtime_error("Inconsistent segment in index file"s);
+    }
+    const auto invalid = [] {
+        return runtime_error("Invalid segment in index file"s);
+    };
+    const int ordinal_end = first_ordinal_ + static_cast<int>(document_count);
+    for (size_t i = 0; i < document_count; ++i) {
+        const auto [document_id, ordinal] = id_to_ordinal_[i];
+        if ((i > 0 && id_to_ordinal_[i - 1].first >= document_id)
+            || ordinal < first_ordinal_ || ordinal >= ordinal_end
+            || documents_.ids[ordinal - first_ordinal_] != document_id
+            || documents_.statuses[i] > DocumentStatus::REMOVED) {
+            throw invalid();
+        }
+    }
+
+    // Blocks are decoded as the cursors do it, so no later read leaves the mapping.
+    // This reads every page of the postings once.
+    const auto term_offsets = file_->GetSection<uint64_t>(IndexSection::TERM_OFFSETS);
+    const size_t term_count = term_offsets.empty() ? 0 : term_offsets.size() - 1;
+    const uint8_t* const bytes_end = bytes_.data() + bytes_.size();
+    for (size_t i = 0; i < term_ids_.size(); ++i) {
+        if (term_ids_[i] >= term_count || (i > 0 && term_ids_[i - 1] >= term_ids_[i])
+            || term_block_offsets_[i] > term_block_offsets_[i + 1]) {
+            throw invalid();
+        }
+        uint64_t document_id = 0;
+        size_t posting_count = 0;
+        for (uint32_t block_index = term_block_offsets_[i];
+             block_index < term_block_offsets_[i + 1]; ++block_index) {
+            const PostingBlock& block = blocks_[block_index];
+            if (block.size == 0 || block.size > POSTING_BLOCK_SIZE
+                || block.offset >= bytes_.size()) {
+                throw invalid();
+            }
+            const uint8_t* data = bytes_.data() + block.offset;
+            for (uint32_t j = 0; j < block.size; ++j) {
+                uint32_t delta = 0;
+                uint32_t occurrence_count = 0;
+                if (!ReadCheckedVarint(data, bytes_end, delta)
+                    || !ReadCheckedVarint(data, bytes_end, occurrence_count)
+                    || (posting_count > 0 && delta == 0)) {
+                    throw invalid();
+                }
+                document_id += delta;
+                ++posting_count;
+                if (document_id < static_cast<uint64_t>(first_ordinal_)
+                    || document_id >= static_cast<uint64_t>(ordinal_end)) {
+                    throw invalid();
+                }
+            }
+            if (document_id != block.last_document_id) {
+                throw invalid();
+            }
+        }
+        if (posting_count != term_document_counts_[i]) {
+            throw invalid();
+        }
+    }
+}
+
+SealedSegment::SealedSegment(shared_ptr<const SealedSegment> source,
+                             const vector<pair<int, vector<TermId>>>& removed_documents)
+    : IndexSegment(source->GetFirstOrdinal())
+    , rebuilt_postings_(source->rebuilt_postings_)
+    , is_removed_(source->is_removed_)
+    , removed_document_count_(source->removed_document_count_)
+    , documents_(source->documents_)
+    , id_to_ordinal_(source->id_to_ordinal_)
+    , term_ids_(source->term_ids_)
+    , term_block_offsets_(source->term_block_offsets_)
+    , term_document_counts_(source->term_document_counts_)
+    , term_max_term_freqs_(source->term_max_term_freqs_)
+    , blocks_(source->blocks_)
+    , bytes_(source->bytes_) {
+    is_removed_.resize(documents_.ids.size());
+    vector<TermId> term_ids;
+    for (const auto& [ordinal, document_term_ids] : removed_documents) {
+        if (!is_removed_[ordinal - first_ordinal_]) {
+            is_removed_[ordinal - first_ordinal_] = true;
+            ++removed_document_count_;
+        }
+        term_ids.insert(term_ids.end(), document_term_ids.begin(), document_term_ids.end());
+    }
+    sort(term_ids.begin(), term_ids.end());
+    term_ids.erase(unique(term_ids.begin(), term_ids.end()), term_ids.end());
+
+    vector<pair<TermId, shared_ptr<const PostingList>>> rebuilt_postings;
+    rebuilt_postings.reserve(term_ids.size());
+    for (TermId term_id : term_ids) {
+        auto postings = make_shared<PostingList>();
+        source->GetPostings(term_id).ForEach([&](int ordinal, uint32_t term_count) {
+            const size_t index = ordinal - first_ordinal_;
+            if (!is_removed_[index]) {
+                postings->Insert(ordinal, term_count,
+                                 term_count * documents_.inv_word_counts[index]);
+            }
+        });
+        rebuilt_postings.push_back({term_id, move(postings)});
+    }
+    // Lists rebuilt by earlier purges are kept unless rebuilt again
+    vector<pair<TermId, shared_ptr<const PostingList>>> merged_postings;
+    merged_postings.reserve(rebuilt_postings_.size() + rebuilt_postings.size());
+    set_union(rebuilt_postings.begin(), rebuilt_postings.end(), rebuilt_postings_.begin(),
+              rebuilt_postings_.end(), back_inserter(merged_postings),
+              [](const auto& lhs, const auto& rhs) {
+                  return lhs.first < rhs.first;
+              });
+    rebuilt_postings_ = move(merged_postings);
+    // Arrays of the source are kept alive by the segment owning them
+    source_ = source->source_ != nullptr ? source->source_ : move(source);
+}
+
+int SealedSegment::GetDocumentCount() const {
+    return static_cast<int>(documents_.ids.size());
+}
+
+int SealedSegment::GetLiveDocumentCount() const {
+    return GetDocumentCount() - removed_document_count_;
+}
+
+DocumentColumns SealedSegment::GetDocuments() const {
+    return documents_;
+}
+
+PostingListView SealedSegment::GetPostings(TermId term_id) const {
+    auto rebuilt_it = lower_bound(rebuilt_postings_.begin(), rebuilt_postings_.end(), term_id,
+                                  [](const auto& entry, TermId value) {
+                                      return entry.first < value;
+                                  });
+    if (rebuilt_it != rebuilt_postings_.end() && rebuilt_it->first == term_id) {
+        return rebuilt_it->second->GetView();
+    }
+    auto it = lower_bound(term_ids_.begin(), term_ids_.end(), term_id);
+    if (it == term_ids_.end() || *it != term_id) {
+        return {};
+    }
+    const size_t index = it - term_ids_.begin();
+    const uint32_t first_block = term_block_offsets_[index];
+    return {blocks_.data() + first_block, term_block_offsets_[index + 1] - first_block,
+            bytes_.data(), term_document_counts_[index], term_max_term_freqs_[index]};
+}
+
+vector<TermId> SealedSegment::GetTermIds() const {
+    vector<TermId> term_ids;
+    term_ids.reserve(term_ids_.size());
+    auto rebuilt_it = rebuilt_postings_.begin();
+    for (TermId term_id : term_ids_) {
+        // Rebuilt lists only cover terms of the shared arrays
+        while (rebuilt_it != rebuilt_postings_.end() && rebuilt_it->first < term_id) {
+            ++rebuilt_it;
+        }
+        if (rebuilt_it == rebuilt_postings_.end() || rebuilt_it->first != term_id
+            || !rebuilt_it->second->empty()) {
+            term_ids.push_back(term_id);
+        }
+    }
+    return term_ids;
+}
+
+bool SealedSegment::IsRemoved(int ordinal) const {
+    return !is_removed_.empty() && is_removed_[ordinal - first_ordinal_];
+}
+
+void SealedSegment::Write(IndexFileWriter& writer) const {
+    writer.WriteSection(IndexSection::DOCUMENT_IDS, documents_.ids);
+    writer.WriteSection(IndexSection::DOCUMENT_RATINGS, documents_.ratings);
+    writer.WriteSection(IndexSection::DOCUMENT_STATUSES, documents_.statuses);
+    writer.WriteSection(IndexSection::DOCUMENT_INV_WORD_COUNTS, documents_.inv_word_counts);
+    writer.WriteSection(IndexSection::ID_TO_ORDINAL, id_to_ordinal_);
+    writer.WriteSection(IndexSection::POSTING_TERM_IDS, term_ids_);
+    writer.WriteSection(IndexSection::POSTING_TERM_BLOCK_OFFSETS, term_block_offsets_);
+    writer.WriteSection(IndexSection::POSTING_TERM_DOCUMENT_COUNTS, term_document_counts_);
+    writer.WriteSection(IndexSection::POSTING_TERM_MAX_TERM_FREQS, term_max_term_freqs_);
+    writer.WriteSection(IndexSection::POSTING_BLOCKS, blocks_);
+    writer.WriteSection(IndexSection::POSTING_BYTES, bytes_);
+}
+
+ArrayView<pair<int, int>> SealedSegment::GetIdIndex() const {
+    return id_to_ordinal_;
+}
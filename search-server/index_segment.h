@@ -0,0 +1,177 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "array_view.h"
+#include "document.h"
+#include "index_file.h"
+#include "posting_list.h"
+#include "term_dictionary.h"
+
+// Attributes of segment documents, indexed by ordinal minus the first ordinal of the segment
+struct DocumentColumns {
+    ArrayView<int> ids;
+    ArrayView<int> ratings;
+    ArrayView<DocumentStatus> statuses;
+    ArrayView<double> inv_word_counts;
+};
+
+// Storage of document columns built in memory
+struct DocumentTable {
+    std::vector<int> ids;
+    std::vector<int> ratings;
+    std::vector<DocumentStatus> statuses;
+    std::vector<double> inv_word_counts;
+
+    void PushBack(int id, int rating, DocumentStatus status, double inv_word_count);
+
+    DocumentColumns GetColumns() const;
+};
+
+// Part of the index covering documents with ordinals in [GetFirstOrdinal(), GetOrdinalEnd())
+class IndexSegment {
+public:
+    explicit IndexSegment(int first_ordinal);
+
+    virtual ~IndexSegment() = default;
+
+    int GetFirstOrdinal() const;
+
+    int GetOrdinalEnd() const;
+
+    virtual DocumentColumns GetDocuments() const = 0;
+
+    // Returns -1 if the segment has no such document or it is removed
+    int FindOrdinal(int document_id) const;
+
+    // Returns an empty view if the term is not met in the segment
+    virtual PostingListView GetPostings(TermId term_id) const = 0;
+
+    // Terms with non-empty posting lists in ascending order
+    virtual std::vector<TermId> GetTermIds() const = 0;
+
+    virtual bool IsRemoved(int ordinal) const = 0;
+
+protected:
+    int first_ordinal_;
+
+    // Ordinals of the documents which are not removed, sorted by document id
+    virtual ArrayView<std::pair<int, int>> GetIdIndex() const = 0;
+};
+
+// Small segment receiving new documents.
+// Copies share posting lists with the original, a shared list is copied before it is
+// changed, so a copy can be updated while the original is being read.
+class MutableSegment : public IndexSegment {
+public:
+    explicit MutableSegment(int first_ordinal);
+
+    // Returns ordinal of the added document
+    int AddDocument(int document_id, DocumentStatus status, int rating, double inv_word_count,
+                    const std::vector<std::pair<TermId, uint32_t>>& term_counts);
+
+    // Existence of the document with the given terms required.
+    // Attributes of the document stay in place until the segment is sealed.
+    void RemoveDocument(int ordinal, const std::vector<TermId>& term_ids);
+
+    // Number of documents including removed ones
+    int GetDocumentCount() const;
+
+    DocumentColumns GetDocuments() const override;
+
+    PostingListView GetPostings(TermId term_id) const override;
+
+    std::vector<TermId> GetTermIds() const override;
+
+    bool IsRemoved(int ordinal) const override;
+
+protected:
+    ArrayView<std::pair<int, int>> GetIdIndex() const override;
+
+private:
+    DocumentTable documents_;
+    std::vector<std::pair<int, int>> id_to_ordinal_;
+    // Sorted by term id
+    std::vector<std::pair<TermId, std::shared_ptr<PostingList>>> term_postings_;
+    std::vector<bool> is_removed_;
+
+    PostingList& GetWritablePostings(TermId term_id);
+};
+
+// Immutable segment with posting lists of all terms packed into shared arrays.
+// The arrays are either built in memory or used in place from a mapped index file.
+class SealedSegment : public IndexSegment {
+public:
+    // Merges source segments with consecutive ordinal ranges, skipping removed documents.
+    // Documents get new dense ordinals starting from the first ordinal of the first source.
+    SealedSegment(const std::vector<const IndexSegment*>& sources,
+                  const std::function<bool(int ordinal)>& is_removed);
+
+    // Throws std::runtime_error if the sections of the file are inconsistent
+    explicit SealedSegment(std::shared_ptr<const IndexFile> file);
+
+    // Copy of the source with the documents removed, given with their terms. Only posting
+    // lists of those terms are rebuilt, other arrays are shared with the source, and the
+    // documents keep their ordinals.
+    SealedSegment(std::shared_ptr<const SealedSegment> source,
+                  const std::vector<std::pair<int, std::vector<TermId>>>& removed_documents);
+
+    SealedSegment(const SealedSegment&) = delete;
+
+    SealedSegment& operator=(const SealedSegment&) = delete;
+
+    // Number of documents including removed ones
+    int GetDocumentCount() const;
+
+    int GetLiveDocumentCount() const;
+
+    DocumentColumns GetDocuments() const override;
+
+    PostingListView GetPostings(TermId term_id) const override;
+
+    std::vector<TermId> GetTermIds() const override;
+
+    bool IsRemoved(int ordinal) const override;
+
+    // Writes document and posting sections, the segment must have no removed documents
+    void Write(IndexFileWriter& writer) const;
+
+protected:
+    ArrayView<std::pair<int, int>> GetIdIndex() const override;
+
+private:
+    struct Storage {
+        DocumentTable documents;
+        std::vector<std::pair<int, int>> id_to_ordinal;
+        std::vector<TermId> term_ids;
+        std::vector<uint32_t> term_block_offsets;
+        std::vector<uint32_t> term_document_counts;
+        std::vector<float> term_max_term_freqs;
+        std::vector<PostingBlock> blocks;
+        std::vector<uint8_t> bytes;
+    };
+
+    // Only one of them holds the arrays, source_ is set for copies with removed documents
+    Storage storage_;
+    std::shared_ptr<const IndexFile> file_;
+    std::shared_ptr<const SealedSegment> source_;
+
+    // Lists of terms of removed documents, sorted by term id, they replace the lists of
+    // the shared arrays
+    std::vector<std::pair<TermId, std::shared_ptr<const PostingList>>> rebuilt_postings_;
+    // Empty unless documents were removed
+    std::vector<bool> is_removed_;
+    int removed_document_count_ = 0;
+
+    DocumentColumns documents_;
+    ArrayView<std::pair<int, int>> id_to_ordinal_;
+    ArrayView<TermId> term_ids_;
+    // Blocks of term_ids_[i] are [term_block_offsets_[i], term_block_offsets_[i + 1])
+    ArrayView<uint32_t> term_block_offsets_;
+    ArrayView<uint32_t> term_document_counts_;
+    ArrayView<float> term_max_term_freqs_;
+    ArrayView<PostingBlock> blocks_;
+    ArrayView<uint8_t> bytes_;
+};
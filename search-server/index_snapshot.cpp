@@ -0,0 +1,108 @@
+#include "index_snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+bool Tombstones::Contains(int ordinal) const {
+    const size_t chunk_index = ordinal / CHUNK_SIZE;
+    if (chunk_index >= chunks_.size() || chunks_[chunk_index] == nullptr) {
+        return false;
+    }
+    const size_t bit = ordinal % CHUNK_SIZE;
+    return ((*chunks_[chunk_index])[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+bool Tombstones::ContainsAny(int ordinal_begin, int ordinal_end) const {
+    bool result = false;
+    // Stops at the chunk with the first removed ordinal of the range
+    for (int ordinal = ordinal_begin; ordinal < ordinal_end && !result;) {
+        const int chunk_end = min<int>(ordinal_end, (ordinal / CHUNK_SIZE + 1) * CHUNK_SIZE);
+        ForEach(ordinal, chunk_end, [&result](int) { result = true; });
+        ordinal = chunk_end;
+    }
+    return result;
+}
+
+void Tombstones::Add(int ordinal) {
+    const size_t chunk_index = ordinal / CHUNK_SIZE;
+    if (chunks_.size() <= chunk_index) {
+        chunks_.resize(chunk_index + 1);
+    }
+    shared_ptr<Chunk>& chunk = chunks_[chunk_index];
+    if (chunk == nullptr) {
+        chunk = make_shared<Chunk>();
+    } else if (chunk.use_count() > 1) {
+        // The chunk is shared with another copy, which may be in use
+        chunk = make_shared<Chunk>(*chunk);
+    }
+    const size_t bit = ordinal % CHUNK_SIZE;
+    (*chunk)[bit / WORD_BITS] |= uint64_t{1} << (bit % WORD_BITS);
+}
+
+void Tombstones::Erase(int ordinal) {
+    if (!Contains(ordinal)) {
+        return;
+    }
+    shared_ptr<Chunk>& chunk = chunks_[ordinal / CHUNK_SIZE];
+    if (chunk.use_count() > 1) {
+        chunk = make_shared<Chunk>(*chunk);
+    }
+    const size_t bit = ordinal % CHUNK_SIZE;
+    (*chunk)[bit / WORD_BITS] &= ~(uint64_t{1} << (bit % WORD_BITS));
+    if (all_of(chunk->begin(), chunk->end(), [](uint64_t word) { return word == 0; })) {
+        chunk.reset();
+    }
+}
+
+vector<const IndexSegment*> IndexSnapshot::GetSegments() const {
+    vector<const IndexSegment*> segments;
+    segments.reserve(sealed_segments.size() + 1);
+    for (const auto& segment : sealed_segments) {
+        segments.push_back(segment.get());
+    }
+    segments.push_back(mutable_segment.get());
+    return segments;
+}
+
+const IndexSegment& IndexSnapshot::FindSegment(int ordinal) const {
+    if (ordinal >= mutable_segment->GetFirstOrdinal()) {
+        return *mutable_segment;
+    }
+    auto it = upper_bound(sealed_segments.begin(), sealed_segments.end(), ordinal,
+                          [](int value, const auto& segment) {
+                              return value < segment->GetFirstOrdinal();
+                          });
+    return **prev(it);
+}
+
+pair<const IndexSegment*, int> IndexSnapshot::FindDocument(int document_id) const {
+    for (const IndexSegment* segment : GetSegments()) {
+        const int ordinal = segment->FindOrdinal(document_id);
+        if (ordinal >= 0 && !tombstones->Contains(ordinal)) {
+            return {segment, ordinal};
+        }
+    }
+    return {nullptr, -1};
+}
+
+int IndexSnapshot::GetTermDocumentCount(TermId term_id) const {
+    return term_statistics.GetDocumentCount(term_id);
+}
+
+double IndexSnapshot::GetInverseDocumentFreq(TermId term_id) const {
+    return log_document_count - term_statistics.GetLogDocumentCount(term_id);
+}
+
+bool IndexSnapshot::HasPostings(TermId term_id) const {
+    const auto segments = GetSegments();
+    return any_of(segments.begin(), segments.end(), [term_id](const IndexSegment* segment) {
+        return !segment->GetPostings(term_id).empty();
+    });
+}
+
+uint64_t MakeSnapshotEpoch() {
+    static atomic<uint64_t> last_epoch{0};
+    return last_epoch.fetch_add(1, memory_order_relaxed) + 1;
+}
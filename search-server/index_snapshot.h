@@ -0,0 +1,101 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "index_segment.h"
+#include "term_statistics.h"
+
+// Ordinals of documents removed from sealed segments whose postings are not purged yet.
+// Copies share the bitmap in chunks, a chunk is copied before it is changed.
+class Tombstones {
+public:
+    static const size_t CHUNK_SIZE = 4096;
+
+    bool Contains(int ordinal) const;
+
+    // True if any ordinal of [ordinal_begin, ordinal_end) is removed
+    bool ContainsAny(int ordinal_begin, int ordinal_end) const;
+
+    void Add(int ordinal);
+
+    void Erase(int ordinal);
+
+    // Calls func(ordinal) for removed ordinals of [ordinal_begin, ordinal_end) in ascending order
+    template <typename Func>
+    void ForEach(int ordinal_begin, int ordinal_end, Func func) const;
+
+private:
+    static const size_t WORD_BITS = 64;
+
+    using Chunk = std::array<uint64_t, CHUNK_SIZE / WORD_BITS>;
+
+    // Null for chunks without removed ordinals
+    std::vector<std::shared_ptr<Chunk>> chunks_;
+};
+
+// Consistent version of the index. A published snapshot is never changed, so readers
+// can use it without locks while writers prepare the next one.
+struct IndexSnapshot {
+    // Segments with growing ordinal ranges, the mutable segment goes after sealed ones
+    std::vector<std::shared_ptr<const SealedSegment>> sealed_segments;
+    std::shared_ptr<const MutableSegment> mutable_segment;
+    std::shared_ptr<const Tombstones> tombstones;
+    // Statistics of documents which are not removed
+    TermStatistics term_statistics;
+    int document_count = 0;
+    // Updated on publishing
+    double log_document_count = 0.0;
+    // Unique among the snapshots of all servers of the process, set on publishing
+    uint64_t epoch = 0;
+
+    std::vector<const IndexSegment*> GetSegments() const;
+
+    // Existence of the document with the ordinal required
+    const IndexSegment& FindSegment(int ordinal) const;
+
+    // Returns the segment and the ordinal of the document, {nullptr, -1} if there is none
+    // or it is removed
+    std::pair<const IndexSegment*, int> FindDocument(int document_id) const;
+
+    // Number of documents containing the term, removed ones are not counted
+    int GetTermDocumentCount(TermId term_id) const;
+
+    // Undefined for terms which are not met in live documents
+    double GetInverseDocumentFreq(TermId term_id) const;
+
+    // True while any segment has postings of the term, including removed documents
+    bool HasPostings(TermId term_id) const;
+};
+
+// Returns a new epoch for a snapshot being published, never zero
+uint64_t MakeSnapshotEpoch();
+
+template <typename Func>
+void Tombstones::ForEach(int ordinal_begin, int ordinal_end, Func func) const {
+    const size_t end = std::min(static_cast<size_t>(std::max(ordinal_end, 0)),
+                                chunks_.size() * CHUNK_SIZE);
+    for (size_t ordinal = std::max(ordinal_begin, 0); ordinal < end;) {
+        const Chunk* chunk = chunks_[ordinal / CHUNK_SIZE].get();
+        if (chunk == nullptr) {
+            ordinal = (ordinal / CHUNK_SIZE + 1) * CHUNK_SIZE;
+            continue;
+        }
+        // Bits below the ordinal are cleared in its word
+        uint64_t word = (*chunk)[ordinal % CHUNK_SIZE / WORD_BITS] >> (ordinal % WORD_BITS)
+                        << (ordinal % WORD_BITS);
+        const size_t word_begin = ordinal - ordinal % WORD_BITS;
+        for (; word != 0; word &= word - 1) {
+            const size_t removed_ordinal = word_begin + __builtin_ctzll(word);
+            if (removed_ordinal >= end) {
+                return;
+            }
+            func(static_cast<int>(removed_ordinal));
+        }
+        ordinal = word_begin + WORD_BITS;
+    }
+}
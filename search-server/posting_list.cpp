@@ -0,0 +1,299 @@
+#include "posting_list.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+static void WriteVarint(vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void AppendPosting(vector<PostingBlock>& blocks, size_t first_block, vector<uint8_t>& bytes,
+                   uint32_t document_id, uint32_t term_count, double term_freq) {
+    const bool is_empty = blocks.size() == first_block;
+    const uint32_t previous_id = is_empty ? 0 : blocks.back().last_document_id;
+    if (is_empty || blocks.back().size == POSTING_BLOCK_SIZE) {
+        blocks.push_back({document_id, static_cast<uint32_t>(bytes.size()), 0, 0.0f});
+    }
+    WriteVarint(bytes, document_id - previous_id);
+    WriteVarint(bytes, term_count);
+    PostingBlock& block = blocks.back();
+    block.last_document_id = document_id;
+    ++block.size;
+    block.max_term_freq = max(block.max_term_freq, RoundUpToFloat(term_freq));
+}
+
+float RoundUpToFloat(double value) {
+    const float result = static_cast<float>(value);
+    return result < value ? nextafter(result, numeric_limits<float>::infinity()) : result;
+}
+
+PostingListView::PostingListView(const PostingBlock* blocks, size_t block_count,
+                                 const uint8_t* bytes, size_t size, float max_term_freq)
+    : blocks_(blocks)
+    , block_count_(block_count)
+    , bytes_(bytes)
+    , size_(size)
+    , max_term_freq_(max_term_freq) {
+}
+
+bool PostingListView::Contains(int document_id) const {
+    const uint32_t id = static_cast<uint32_t>(document_id);
+    if (document_id < 0 || block_count_ == 0 || blocks_[block_count_ - 1].last_document_id < id) {
+        return false;
+    }
+    const PostingBlock* block = lower_bound(blocks_, blocks_ + block_count_, id,
+                                            [](const PostingBlock& block, uint32_t value) {
+                                                return block.last_document_id < value;
+                                            });
+    const uint8_t* data = bytes_ + block->offset;
+    uint32_t current_id = block == blocks_ ? 0 : (block - 1)->last_document_id;
+    for (uint32_t i = 0; i < block->size; ++i) {
+        current_id += ReadVarint(data);
+        if (current_id >= id) {
+            return current_id == id;
+        }
+        ReadVarint(data);
+    }
+    return false;
+}
+
+size_t PostingListView::size() const {
+    return size_;
+}
+
+bool PostingListView::empty() const {
+    return size_ == 0;
+}
+
+float PostingListView::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+PostingCursor::PostingCursor(const PostingListView& postings)
+    : postings_(postings) {
+    if (postings_.block_count_ == 0) {
+        is_end_ = true;
+        return;
+    }
+    LoadBlock(0);
+}
+
+bool PostingCursor::IsEnd() const {
+    return is_end_;
+}
+
+int PostingCursor::GetDocumentId() const {
+    return is_end_ ? numeric_limits<int>::max() : static_cast<int>(document_id_);
+}
+
+uint32_t PostingCursor::GetTermCount() const {
+    return term_count_;
+}
+
+void PostingCursor::Next() {
+    if (is_end_) {
+        return;
+    }
+    if (index_in_block_ < postings_.blocks_[block_index_].size) {
+        ReadPosting();
+    } else if (block_index_ + 1 < postings_.block_count_) {
+        LoadBlock(block_index_ + 1);
+    } else {
+        is_end_ = true;
+    }
+}
+
+void PostingCursor::Advance(int document_id) {
+    if (is_end_ || GetDocumentId() >= document_id) {
+        return;
+    }
+    const uint32_t id = static_cast<uint32_t>(document_id);
+    if (postings_.blocks_[block_index_].last_document_id < id) {
+        const PostingBlock* blocks_end = postings_.blocks_ + postings_.block_count_;
+        const PostingBlock* block = lower_bound(postings_.blocks_ + block_index_ + 1, blocks_end,
+                                                id, [](const PostingBlock& block, uint32_t value) {
+                                                    return block.last_document_id < value;
+                                                });
+        if (block == blocks_end) {
+            is_end_ = true;
+            return;
+        }
+        LoadBlock(block - postings_.blocks_);
+    }
+    // The block ends with an id not less than the target
+    while (document_id_ < id) {
+        ReadPosting();
+    }
+}
+
+void PostingCursor::ShallowAdvance(int document_id) {
+    const uint32_t id = static_cast<uint32_t>(document_id);
+    shallow_block_index_ = max(shallow_block_index_, block_index_);
+    while (shallow_block_index_ < postings_.block_count_
+           && postings_.blocks_[shallow_block_index_].last_document_id < id) {
+        ++shallow_block_index_;
+    }
+}
+
+float PostingCursor::GetBlockMaxTermFreq() const {
+    return shallow_block_index_ < postings_.block_count_
+        ? postings_.blocks_[shallow_block_index_].max_term_freq : 0.0f;
+}
+
+int PostingCursor::GetBlockLastDocumentId() const {
+    return shallow_block_index_ < postings_.block_count_
+        ? static_cast<int>(postings_.blocks_[shallow_block_index_].last_document_id)
+        : numeric_limits<int>::max();
+}
+
+void PostingCursor::LoadBlock(size_t block_index) {
+    block_index_ = block_index;
+    index_in_block_ = 0;
+    data_ = postings_.bytes_ + postings_.blocks_[block_index].offset;
+    document_id_ = block_index == 0 ? 0 : postings_.blocks_[block_index - 1].last_document_id;
+    ReadPosting();
+}
+
+void PostingCursor::ReadPosting() {
+    document_id_ += PostingListView::ReadVarint(data_);
+    term_count_ = PostingListView::ReadVarint(data_);
+    ++index_in_block_;
+}
+
+void PostingList::Insert(int document_id, uint32_t term_count, double term_freq) {
+    const uint32_t id = static_cast<uint32_t>(document_id);
+    ++size_;
+    max_term_freq_ = max(max_term_freq_, RoundUpToFloat(term_freq));
+    if (blocks_.empty() || blocks_.back().last_document_id < id) {
+        // Appending to the tail is the common case and does not touch existing blocks
+        AppendPosting(blocks_, 0, bytes_, id, term_count, term_freq);
+        return;
+    }
+    const size_t block_index = FindBlock(id);
+    vector<Posting> postings;
+    DecodeBlocks(block_index, block_index + 1, postings);
+    auto it = lower_bound(postings.begin(), postings.end(), id,
+                          [](const Posting& posting, uint32_t value) {
+                              return posting.document_id < value;
+                          });
+    postings.insert(it, {id, term_count});
+    ReplaceBlocks(block_index, block_index + 1, postings,
+                  max(GetMaxTermFreq(block_index, block_index + 1), RoundUpToFloat(term_freq)));
+}
+
+bool PostingList::Erase(int document_id) {
+    const uint32_t id = static_cast<uint32_t>(document_id);
+    if (document_id < 0 || blocks_.empty() || blocks_.back().last_document_id < id) {
+        return false;
+    }
+    const size_t block_index = FindBlock(id);
+    // The next block is encoded relative to the last id of this one, so it has to be
+    // re-encoded as well when that id goes away
+    size_t last_block = block_index + 1;
+    if (blocks_[block_index].last_document_id == id && last_block < blocks_.size()) {
+        ++last_block;
+    }
+    vector<Posting> postings;
+    DecodeBlocks(block_index, last_block, postings);
+    auto it = find_if(postings.begin(), postings.end(), [id](const Posting& posting) {
+        return posting.document_id == id;
+    });
+    if (it == postings.end()) {
+        return false;
+    }
+    postings.erase(it);
+    ReplaceBlocks(block_index, last_block, postings, GetMaxTermFreq(block_index, last_block));
+    --size_;
+    return true;
+}
+
+bool PostingList::Contains(int document_id) const {
+    return GetView().Contains(document_id);
+}
+
+size_t PostingList::size() const {
+    return size_;
+}
+
+bool PostingList::empty() const {
+    return size_ == 0;
+}
+
+PostingListView PostingList::GetView() const {
+    return {blocks_.data(), blocks_.size(), bytes_.data(), size_, max_term_freq_};
+}
+
+size_t PostingList::GetBlockEnd(size_t block_index) const {
+    return block_index + 1 < blocks_.size() ? blocks_[block_index + 1].offset : bytes_.size();
+}
+
+uint32_t PostingList::GetBlockBase(size_t block_index) const {
+    return block_index == 0 ? 0 : blocks_[block_index - 1].last_document_id;
+}
+
+size_t PostingList::FindBlock(uint32_t document_id) const {
+    // Existence of a block with last id not less than document_id required
+    auto it = lower_bound(blocks_.begin(), blocks_.end(), document_id,
+                          [](const PostingBlock& block, uint32_t value) {
+                              return block.last_document_id < value;
+                          });
+    return it - blocks_.begin();
+}
+
+void PostingList::DecodeBlocks(size_t first_block, size_t last_block,
+                               vector<Posting>& out) const {
+    uint32_t document_id = GetBlockBase(first_block);
+    for (size_t block_index = first_block; block_index < last_block; ++block_index) {
+        const PostingBlock& block = blocks_[block_index];
+        const uint8_t* data = bytes_.data() + block.offset;
+        for (uint32_t i = 0; i < block.size; ++i) {
+            document_id += PostingListView::ReadVarint(data);
+            out.push_back({document_id, PostingListView::ReadVarint(data)});
+        }
+    }
+}
+
+float PostingList::GetMaxTermFreq(size_t first_block, size_t last_block) const {
+    float max_term_freq = 0.0f;
+    for (size_t block_index = first_block; block_index < last_block; ++block_index) {
+        max_term_freq = max(max_term_freq, blocks_[block_index].max_term_freq);
+    }
+    return max_term_freq;
+}
+
+void PostingList::ReplaceBlocks(size_t first_block, size_t last_block,
+                                const vector<Posting>& postings, float max_term_freq) {
+    const size_t begin_offset = blocks_[first_block].offset;
+    const size_t end_offset = GetBlockEnd(last_block - 1);
+
+    vector<PostingBlock> new_blocks;
+    vector<uint8_t> new_bytes;
+    uint32_t previous_id = GetBlockBase(first_block);
+    for (size_t i = 0; i < postings.size(); ++i) {
+        if (i % POSTING_BLOCK_SIZE == 0) {
+            new_blocks.push_back({0, static_cast<uint32_t>(begin_offset + new_bytes.size()), 0,
+                                  max_term_freq});
+        }
+        WriteVarint(new_bytes, postings[i].document_id - previous_id);
+        WriteVarint(new_bytes, postings[i].term_count);
+        previous_id = postings[i].document_id;
+        new_blocks.back().last_document_id = previous_id;
+        ++new_blocks.back().size;
+    }
+
+    const long long offset_shift = static_cast<long long>(new_bytes.size())
+                                   - static_cast<long long>(end_offset - begin_offset);
+    for (size_t block_index = last_block; block_index < blocks_.size(); ++block_index) {
+        blocks_[block_index].offset = static_cast<uint32_t>(blocks_[block_index].offset + offset_shift);
+    }
+    bytes_.erase(bytes_.begin() + begin_offset, bytes_.begin() + end_offset);
+    bytes_.insert(bytes_.begin() + begin_offset, new_bytes.begin(), new_bytes.end());
+    blocks_.erase(blocks_.begin() + first_block, blocks_.begin() + last_block);
+    blocks_.insert(blocks_.begin() + first_block, new_blocks.begin(), new_blocks.end());
+}
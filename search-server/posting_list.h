@@ -0,0 +1,197 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Postings of a term are split into blocks of up to POSTING_BLOCK_SIZE entries.
+// Every block stores varint-encoded document id deltas interleaved with term
+// occurrence counts. The first delta of a block is taken from the last id of the
+// previous block of the same list.
+// Blocks and lists keep an upper bound of the term frequency (term count divided by
+// the number of document words) of their postings, so top-k queries can skip postings
+// which can not get into the results.
+const size_t POSTING_BLOCK_SIZE = 128;
+
+struct PostingBlock {
+    uint32_t last_document_id;
+    // Offset of the block data from the beginning of the byte storage
+    uint32_t offset;
+    uint32_t size;
+    float max_term_freq;
+};
+
+// Appends a posting to the list whose blocks start at first_block.
+// Document id has to be greater than the ids already in the list.
+void AppendPosting(std::vector<PostingBlock>& blocks, size_t first_block,
+                   std::vector<uint8_t>& bytes, uint32_t document_id, uint32_t term_count,
+                   double term_freq);
+
+// Nearest float which is not less than the value
+float RoundUpToFloat(double value);
+
+// Read-only view of an encoded posting list
+class PostingListView {
+public:
+    PostingListView() = default;
+
+    PostingListView(const PostingBlock* blocks, size_t block_count, const uint8_t* bytes,
+                    size_t size, float max_term_freq);
+
+    bool Contains(int document_id) const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    float GetMaxTermFreq() const;
+
+    // Calls func(document_id, term_count) for every posting in ascending document id order
+    template <typename Func>
+    void ForEach(Func func) const;
+
+    // ForEach which calls on_block(posting_count) before every block of postings and stops
+    // once it returns false
+    template <typename Func, typename BlockFunc>
+    void ForEach(Func func, BlockFunc on_block) const;
+
+    static uint32_t ReadVarint(const uint8_t*& data);
+
+private:
+    friend class PostingCursor;
+
+    const PostingBlock* blocks_ = nullptr;
+    size_t block_count_ = 0;
+    const uint8_t* bytes_ = nullptr;
+    size_t size_ = 0;
+    float max_term_freq_ = 0.0f;
+};
+
+// Forward iterator over a posting list. Blocks ending before the target of Advance
+// are skipped without decoding.
+class PostingCursor {
+public:
+    explicit PostingCursor(const PostingListView& postings);
+
+    bool IsEnd() const;
+
+    // Returns the maximum int at the end
+    int GetDocumentId() const;
+
+    uint32_t GetTermCount() const;
+
+    void Next();
+
+    // Moves to the first posting with document id not less than the given one
+    void Advance(int document_id);
+
+    // Finds the block which may contain the document without decoding it.
+    // Document ids have to grow between calls.
+    void ShallowAdvance(int document_id);
+
+    // Bound of the block found by ShallowAdvance, zero past the last block
+    float GetBlockMaxTermFreq() const;
+
+    // Last document id of the block found by ShallowAdvance, the maximum int past the
+    // last block
+    int GetBlockLastDocumentId() const;
+
+private:
+    PostingListView postings_;
+    size_t block_index_ = 0;
+    uint32_t index_in_block_ = 0;
+    const uint8_t* data_ = nullptr;
+    uint32_t document_id_ = 0;
+    uint32_t term_count_ = 0;
+    bool is_end_ = false;
+    size_t shallow_block_index_ = 0;
+
+    void LoadBlock(size_t block_index);
+
+    void ReadPosting();
+};
+
+// Docid-sorted posting list of a single term which supports updates
+class PostingList {
+public:
+    struct Posting {
+        uint32_t document_id;
+        uint32_t term_count;
+    };
+
+    // Document must not be in the list yet
+    void Insert(int document_id, uint32_t term_count, double term_freq);
+
+    // Returns false if the document is not in the list
+    bool Erase(int document_id);
+
+    bool Contains(int document_id) const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    PostingListView GetView() const;
+
+    template <typename Func>
+    void ForEach(Func func) const;
+
+private:
+    std::vector<PostingBlock> blocks_;
+    std::vector<uint8_t> bytes_;
+    size_t size_ = 0;
+    // Not lowered by Erase
+    float max_term_freq_ = 0.0f;
+
+    size_t GetBlockEnd(size_t block_index) const;
+
+    uint32_t GetBlockBase(size_t block_index) const;
+
+    size_t FindBlock(uint32_t document_id) const;
+
+    void DecodeBlocks(size_t first_block, size_t last_block, std::vector<Posting>& out) const;
+
+    // Replaces blocks [first_block, last_block) with the given postings, the new blocks
+    // get the given bound
+    void ReplaceBlocks(size_t first_block, size_t last_block, const std::vector<Posting>& postings,
+                       float max_term_freq);
+
+    float GetMaxTermFreq(size_t first_block, size_t last_block) const;
+};
+
+inline uint32_t PostingListView::ReadVarint(const uint8_t*& data) {
+    uint32_t value = *data & 0x7F;
+    for (int shift = 7; *data++ & 0x80; shift += 7) {
+        value |= static_cast<uint32_t>(*data & 0x7F) << shift;
+    }
+    return value;
+}
+
+template <typename Func>
+void PostingListView::ForEach(Func func) const {
+    ForEach(func, [](size_t) {
+        return true;
+    });
+}
+
+template <typename Func, typename BlockFunc>
+void PostingListView::ForEach(Func func, BlockFunc on_block) const {
+    uint32_t document_id = 0;
+    for (size_t block_index = 0; block_index < block_count_; ++block_index) {
+        const PostingBlock& block = blocks_[block_index];
+        if (!on_block(static_cast<size_t>(block.size))) {
+            return;
+        }
+        const uint8_t* data = bytes_ + block.offset;
+        for (uint32_t i = 0; i < block.size; ++i) {
+            document_id += ReadVarint(data);
+            const uint32_t term_count = ReadVarint(data);
+            func(static_cast<int>(document_id), term_count);
+        }
+    }
+}
+
+template <typename Func>
+void PostingList::ForEach(Func func) const {
+    GetView().ForEach(func);
+}
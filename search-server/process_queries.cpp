@@ -6,22 +6,120 @@ vector<vector<Document>> ProcessQueries(
     const SearchServer& search_server,
     const vector<string>& queries) {
         vector<vector<Document>> result(queries.size());
-        transform(execution::par, queries.begin(), queries.end(), result.begin(),
-                  [&search_server](const string& query) {
-                      return search_server.FindTopDocuments(query);
-                  });
-        
+        search_server.GetThreadPool()->ParallelFor(queries.size(),
+            [&search_server, &queries, &result](size_t index) {
+                result[index] = search_server.FindTopDocuments(queries[index]);
+            });
+
     return result;
 }
 
-list<Document> ProcessQueriesJoined(
+JoinedDocuments::Iterator::Iterator(QueryIterator query, QueryIterator queries_end,
+                                    size_t index)
+    : query_(query)
+    , queries_end_(queries_end)
+    , index_(index) {
+    SkipEmptyQueries();
+}
+
+const Document& JoinedDocuments::Iterator::operator*() const {
+    return (*query_)[index_];
+}
+
+const Document* JoinedDocuments::Iterator::operator->() const {
+    return &(*query_)[index_];
+}
+
+JoinedDocuments::Iterator& JoinedDocuments::Iterator::operator++() {
+    ++index_;
+    SkipEmptyQueries();
+    return *this;
+}
+
+JoinedDocuments::Iterator JoinedDocuments::Iterator::operator++(int) {
+    Iterator old = *this;
+    ++*this;
+    return old;
+}
+
+JoinedDocuments::Iterator& JoinedDocuments::Iterator::operator--() {
+    if (index_ == 0) {
+        do {
+            --query_;
+        } while (query_->empty());
+        index_ = query_->size();
+    }
+    --index_;
+    return *this;
+}
+
+JoinedDocuments::Iterator JoinedDocuments::Iterator::operator--(int) {
+    Iterator old = *this;
+    --*this;
+    return old;
+}
+
+bool JoinedDocuments::Iterator::operator==(const Iterator& other) const {
+    return query_ == other.query_ && index_ == other.index_;
+}
+
+bool JoinedDocuments::Iterator::operator!=(const Iterator& other) const {
+    return !(*this == other);
+}
+
+void JoinedDocuments::Iterator::SkipEmptyQueries() {
+    while (query_ != queries_end_ && index_ == query_->size()) {
+        ++query_;
+        index_ = 0;
+    }
+}
+
+JoinedDocuments::JoinedDocuments(vector<vector<Document>> query_documents)
+    : query_documents_(move(query_documents)) {
+    for (const vector<Document>& documents : query_documents_) {
+        size_ += documents.size();
+    }
+}
+
+JoinedDocuments::Iterator JoinedDocuments::begin() const {
+    return Iterator(query_documents_.begin(), query_documents_.end(), 0);
+}
+
+JoinedDocuments::Iterator JoinedDocuments::end() const {
+    return Iterator(query_documents_.end(), query_documents_.end(), 0);
+}
+
+size_t JoinedDocuments::size() const {
+    return size_;
+}
+
+bool JoinedDocuments::empty() const {
+    return size_ == 0;
+}
+
+const Document& JoinedDocuments::front() const {
+    return *begin();
+}
+
+const Document& JoinedDocuments::back() const {
+    return *--end();
+}
+
+void JoinedDocuments::pop_back() {
+    auto query = query_documents_.rbegin();
+    while (query->empty()) {
+        ++query;
+    }
+    query->pop_back();
+    --size_;
+}
+
+const vector<vector<Document>>& JoinedDocuments::GetQueryDocuments() const {
+    return query_documents_;
+}
+
+JoinedDocuments ProcessQueriesJoined(
     const SearchServer& search_server,
     const vector<string>& queries) {
-        list<Document> result;
-        vector<vector<Document>> result_unjoined = ProcessQueries(search_server, queries);
-        for (const vector<Document>& documents : result_unjoined) {
-            result.insert(result.end(), documents.begin(), documents.end());
-        }
-
-        return result;
+        return JoinedDocuments(ProcessQueries(search_server, queries));
 }
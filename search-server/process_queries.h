@@ -1,7 +1,8 @@
 #pragma once
 #include <algorithm>
+#include <cstddef>
 #include <execution>
-#include <list>
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -11,6 +12,66 @@ std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
 
-std::list<Document> ProcessQueriesJoined(
+// Results of a batch of queries read as one sequence, query after query. The results of
+// every query stay in their own vector, nothing is copied to join them.
+class JoinedDocuments {
+public:
+    using QueryIterator = std::vector<std::vector<Document>>::const_iterator;
+
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = Document;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Document*;
+        using reference = const Document&;
+
+        Iterator() = default;
+
+        reference operator*() const;
+        pointer operator->() const;
+        Iterator& operator++();
+        Iterator operator++(int);
+        Iterator& operator--();
+        Iterator operator--(int);
+
+        bool operator==(const Iterator& other) const;
+        bool operator!=(const Iterator& other) const;
+
+    private:
+        friend class JoinedDocuments;
+
+        // Query points to a query with results or to queries_end
+        Iterator(QueryIterator query, QueryIterator queries_end, size_t index);
+
+        void SkipEmptyQueries();
+
+        QueryIterator query_;
+        QueryIterator queries_end_;
+        size_t index_ = 0;
+    };
+
+    JoinedDocuments() = default;
+    explicit JoinedDocuments(std::vector<std::vector<Document>> query_documents);
+
+    Iterator begin() const;
+    Iterator end() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    const Document& front() const;
+    const Document& back() const;
+    void pop_back();
+
+    // Results of every query in the order of the queries
+    const std::vector<std::vector<Document>>& GetQueryDocuments() const;
+
+private:
+    std::vector<std::vector<Document>> query_documents_;
+    size_t size_ = 0;
+};
+
+JoinedDocuments ProcessQueriesJoined(
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
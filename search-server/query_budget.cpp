@@ -0,0 +1,37 @@
+#include "query_budget.h"
+
+using namespace std;
+
+QueryBudgetTracker::QueryBudgetTracker(const QueryBudget& budget)
+    : budget_(budget)
+    , is_limited_(budget.max_scored_postings > 0 || budget.deadline.has_value()
+                  || budget.cancellation.CanBeCancelled()) {
+}
+
+void QueryBudgetTracker::Spend(size_t posting_count) {
+    if (is_limited_) {
+        scored_posting_count_.fetch_add(posting_count, memory_order_relaxed);
+    }
+}
+
+bool QueryBudgetTracker::IsExhausted() {
+    if (!is_limited_) {
+        return false;
+    }
+    if (is_exhausted_.load(memory_order_relaxed)) {
+        return true;
+    }
+    const bool is_exhausted =
+        (budget_.max_scored_postings > 0
+         && scored_posting_count_.load(memory_order_relaxed) >= budget_.max_scored_postings)
+        || (budget_.deadline && chrono::steady_clock::now() >= *budget_.deadline)
+        || budget_.cancellation.IsCancelled();
+    if (is_exhausted) {
+        is_exhausted_.store(true, memory_order_relaxed);
+    }
+    return is_exhausted;
+}
+
+bool QueryBudgetTracker::WasExhausted() const {
+    return is_exhausted_.load(memory_order_relaxed);
+}
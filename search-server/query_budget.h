@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+
+#include "cancellation.h"
+
+// Limits on the work of a single query. A query which runs out of its budget stops
+// scanning and returns the best documents among the scanned postings.
+struct QueryBudget {
+    // Zero means no limit
+    size_t max_scored_postings = 0;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    // A cancelled token runs the budget out
+    CancellationToken cancellation;
+};
+
+// Postings scored by a query against its budget, shared by the threads of the query.
+// Scans check the budget before every block of postings, so a long list is cut in the
+// middle as well.
+class QueryBudgetTracker {
+public:
+    explicit QueryBudgetTracker(const QueryBudget& budget);
+
+    void Spend(size_t posting_count);
+
+    // Stays true once the budget has run out. Callers ask only when postings are left and
+    // skip the rest of the scan when it returns true.
+    bool IsExhausted();
+
+    // Whether IsExhausted has returned true, so a part of the postings was not scanned
+    bool WasExhausted() const;
+
+private:
+    const QueryBudget budget_;
+    const bool is_limited_;
+    std::atomic<size_t> scored_posting_count_{0};
+    std::atomic<bool> is_exhausted_{false};
+};
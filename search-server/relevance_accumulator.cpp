@@ -0,0 +1,33 @@
+#include "relevance_accumulator.h"
+
+#include <algorithm>
+
+using namespace std;
+
+RelevanceAccumulator& RelevanceAccumulator::GetThreadLocal() {
+    thread_local RelevanceAccumulator accumulator;
+    return accumulator;
+}
+
+void RelevanceAccumulator::Reset(size_t document_count) {
+    for (uint32_t index : touched_) {
+        relevances_[index] = 0.0;
+        states_[index] = UNTOUCHED;
+    }
+    touched_.clear();
+    if (relevances_.size() < document_count) {
+        relevances_.resize(document_count, 0.0);
+        states_.resize(document_count, UNTOUCHED);
+    }
+}
+
+vector<uint32_t>& RelevanceAccumulator::GetScored() {
+    sort(touched_.begin(), touched_.end());
+    scored_.clear();
+    for (uint32_t index : touched_) {
+        if (states_[index] == SCORED) {
+            scored_.push_back(index);
+        }
+    }
+    return scored_;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Relevance of the documents of one segment, indexed by ordinal minus the first ordinal.
+// Only the touched entries are cleared between queries, so the buffers are reused by
+// queries of any size without allocations once they have grown to the largest segment.
+class RelevanceAccumulator {
+public:
+    // Buffers owned by the calling thread. Must not be used by nested queries.
+    static RelevanceAccumulator& GetThreadLocal();
+
+    // Clears the previous segment and prepares for documents [0, document_count)
+    void Reset(size_t document_count);
+
+    void Add(size_t index, double relevance);
+
+    // The document is left out of the results whatever is added to it
+    void Exclude(size_t index);
+
+    // Ascending indexes of the documents which are scored and not excluded. The list may
+    // be narrowed by the caller, it is reused by the next segment.
+    std::vector<uint32_t>& GetScored();
+
+    double GetRelevance(size_t index) const;
+
+private:
+    enum State : uint8_t {
+        UNTOUCHED,
+        SCORED,
+        EXCLUDED,
+    };
+
+    std::vector<double> relevances_;
+    std::vector<State> states_;
+    std::vector<uint32_t> touched_;
+    std::vector<uint32_t> scored_;
+};
+
+inline void RelevanceAccumulator::Add(size_t index, double relevance) {
+    if (states_[index] == UNTOUCHED) {
+        states_[index] = SCORED;
+        touched_.push_back(static_cast<uint32_t>(index));
+    }
+    relevances_[index] += relevance;
+}
+
+inline void RelevanceAccumulator::Exclude(size_t index) {
+    if (states_[index] == UNTOUCHED) {
+        touched_.push_back(static_cast<uint32_t>(index));
+    }
+    states_[index] = EXCLUDED;
+}
+
+inline double RelevanceAccumulator::GetRelevance(size_t index) const {
+    return relevances_[index];
+}
@@ -20,6 +20,18 @@ vector<Document> RequestQueue::AddFindRequest(const string& raw_query) {
     return result;
 }
 
+vector<Document> RequestQueue::AddFindRequest(const PreparedQuery& query, DocumentStatus status) {
+    const auto result = search_server_.FindTopDocuments(query, status);
+    AddRequest(result.size());
+    return result;
+}
+
+vector<Document> RequestQueue::AddFindRequest(const PreparedQuery& query) {
+    const auto result = search_server_.FindTopDocuments(query);
+    AddRequest(result.size());
+    return result;
+}
+
 int RequestQueue::GetNoResultRequests() const {
     return no_results_requests_;
 }
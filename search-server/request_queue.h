@@ -15,6 +15,14 @@ public:
 
     std::vector<Document> AddFindRequest(const std::string& raw_query);
 
+    template <typename DocumentPredicate>
+    std::vector<Document> AddFindRequest(const PreparedQuery& query,
+                                         DocumentPredicate document_predicate);
+
+    std::vector<Document> AddFindRequest(const PreparedQuery& query, DocumentStatus status);
+
+    std::vector<Document> AddFindRequest(const PreparedQuery& query);
+
     int GetNoResultRequests() const;
 
 private:
@@ -38,3 +46,11 @@ std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query,
     AddRequest(result.size());
     return result;
 }
+
+template <typename DocumentPredicate>
+std::vector<Document> RequestQueue::AddFindRequest(const PreparedQuery& query,
+                                                   DocumentPredicate document_predicate) {
+    const auto result = search_server_.FindTopDocuments(query, document_predicate);
+    AddRequest(result.size());
+    return result;
+}
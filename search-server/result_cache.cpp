@@ -0,0 +1,65 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+ResultCache::ResultCache(size_t capacity, size_t shard_count)
+    : shards_(max<size_t>(min(shard_count, capacity), 1))
+    , shard_capacity_(max<size_t>((capacity + shards_.size() - 1) / shards_.size(), 1)) {
+}
+
+optional<vector<Document>> ResultCache::Find(const string& key, uint64_t epoch) {
+    Shard& shard = GetShard(key);
+    lock_guard guard(shard.mutex);
+    const auto it = shard.key_to_entry.find(key);
+    if (it == shard.key_to_entry.end()) {
+        misses_.fetch_add(1, memory_order_relaxed);
+        return nullopt;
+    }
+    if (it->second->epoch != epoch) {
+        // Only an entry of an older version is dropped, a query on an older snapshot
+        // must not evict the result of a newer one
+        if (it->second->epoch < epoch) {
+            shard.entries.erase(it->second);
+            shard.key_to_entry.erase(it);
+        }
+        misses_.fetch_add(1, memory_order_relaxed);
+        return nullopt;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    hits_.fetch_add(1, memory_order_relaxed);
+    return it->second->documents;
+}
+
+void ResultCache::Insert(const string& key, uint64_t epoch, const vector<Document>& documents) {
+    Shard& shard = GetShard(key);
+    lock_guard guard(shard.mutex);
+    const auto it = shard.key_to_entry.find(key);
+    if (it != shard.key_to_entry.end()) {
+        // A newer epoch wins when queries on different snapshots race
+        if (it->second->epoch <= epoch) {
+            it->second->epoch = epoch;
+            it->second->documents = documents;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+    if (shard.entries.size() >= shard_capacity_) {
+        shard.key_to_entry.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+        evictions_.fetch_add(1, memory_order_relaxed);
+    }
+    shard.entries.push_front({key, epoch, documents});
+    shard.key_to_entry.emplace(key, shard.entries.begin());
+}
+
+ResultCacheStats ResultCache::GetStats() const {
+    return {hits_.load(memory_order_relaxed), misses_.load(memory_order_relaxed),
+            evictions_.load(memory_order_relaxed)};
+}
+
+ResultCache::Shard& ResultCache::GetShard(const string& key) {
+    return shards_[hash<string>{}(key) % shards_.size()];
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+struct ResultCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Entries dropped to make room for new ones
+    uint64_t evictions = 0;
+};
+
+// Results of queries by a normalized key. Every entry remembers the epoch of the index
+// snapshot it was computed on and is a miss for any other epoch, so changes of the index
+// invalidate the cache without visiting it. A lookup drops entries of older epochs only.
+// Keys are spread over shards, each one a separate LRU list under its own lock.
+class ResultCache {
+public:
+    ResultCache(size_t capacity, size_t shard_count);
+
+    std::optional<std::vector<Document>> Find(const std::string& key, uint64_t epoch);
+
+    void Insert(const std::string& key, uint64_t epoch, const std::vector<Document>& documents);
+
+    ResultCacheStats GetStats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t epoch;
+        std::vector<Document> documents;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        // Most recently used first
+        std::list<Entry> entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> key_to_entry;
+    };
+
+    std::vector<Shard> shards_;
+    size_t shard_capacity_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+
+    Shard& GetShard(const std::string& key);
+};
@@ -14,20 +14,147 @@ SearchServer::SearchServer(string_view stop_words_text)
 {
 }
 
+SearchServer::~SearchServer() {
+    {
+        unique_lock lock(async_query_mutex_);
+        async_queries_finished_.wait(lock, [this]() {
+            return async_query_count_ == 0;
+        });
+    }
+    {
+        lock_guard guard(background_mutex_);
+        is_background_stopped_ = true;
+    }
+    background_work_requested_.notify_one();
+    if (background_thread_.joinable()) {
+        background_thread_.join();
+    }
+}
+
+SearchServer::SearchServer(shared_ptr<const IndexFile> index_file)
+    : stop_words_(LoadStopWords(*index_file))
+    , terms_(index_file->GetStrings(IndexSection::TERM_OFFSETS, IndexSection::TERM_TEXT))
+    , index_file_(index_file)
+    , log_sequence_number_(index_file->GetLogSequenceNumber())
+{
+    auto segment = make_shared<const SealedSegment>(index_file);
+    if (index_file->GetSection<uint64_t>(IndexSection::WORD_FREQ_OFFSETS).size()
+            != static_cast<size_t>(segment->GetDocumentCount()) + 1
+        || index_file->GetSection<TermId>(IndexSection::WORD_FREQ_TERM_IDS).size()
+            != index_file->GetSection<double>(IndexSection::WORD_FREQ_VALUES).size()) {
+        throw runtime_error("Inconsistent word frequencies in index file"s);
+    }
+    for (int document_id : segment->GetDocuments().ids) {
+        document_ids_.insert(document_id);
+    }
+    IndexDraft draft = BeginWrite();
+    draft.snapshot.document_count = segment->GetDocumentCount();
+    for (TermId term_id : segment->GetTermIds()) {
+        draft.snapshot.term_statistics.AddDocuments(
+            term_id, static_cast<int>(segment->GetPostings(term_id).size()));
+    }
+    draft.mutable_segment = make_shared<MutableSegment>(segment->GetOrdinalEnd());
+    if (segment->GetDocumentCount() > 0) {
+        draft.snapshot.sealed_segments.push_back(move(segment));
+    }
+    Publish(draft);
+}
+
+set<string, less<>> SearchServer::LoadStopWords(const IndexFile& index_file) {
+    set<string, less<>> stop_words;
+    for (string_view word : index_file.GetStrings(IndexSection::STOP_WORD_OFFSETS,
+                                                  IndexSection::STOP_WORD_TEXT)) {
+        stop_words.emplace(word);
+    }
+    return stop_words;
+}
+
+SearchServer SearchServer::Open(const string& path) {
+    return SearchServer(make_shared<const IndexFile>(path));
+}
+
+void SearchServer::Save(const string& path) const {
+    lock_guard guard(write_mutex_);
+    // All segments are merged into one, the file keeps ordinals and term ids
+    const auto snapshot = GetSnapshot();
+    const Tombstones& tombstones = *snapshot->tombstones;
+    const SealedSegment segment(snapshot->GetSegments(), [&tombstones](int ordinal) {
+        return tombstones.Contains(ordinal);
+    });
+    IndexFileWriter writer(path, segment.GetFirstOrdinal(), log_sequence_number_);
+    writer.WriteStrings(IndexSection::STOP_WORD_OFFSETS, IndexSection::STOP_WORD_TEXT,
+                        {stop_words_.begin(), stop_words_.end()});
+    vector<string_view> terms;
+    terms.reserve(terms_.GetTermCount());
+    for (TermId term_id = 0; term_id < terms_.GetTermCount(); ++term_id) {
+        terms.push_back(terms_.GetTerm(term_id));
+    }
+    writer.WriteStrings(IndexSection::TERM_OFFSETS, IndexSection::TERM_TEXT, terms);
+    segment.Write(writer);
+
+    // Word frequencies of documents in ordinal order, words are sorted in every document
+    vector<uint64_t> offsets = {0};
+    vector<TermId> term_ids;
+    vector<double> freqs;
+    for (int document_id : segment.GetDocuments().ids) {
+        for (const auto& [word, freq] : GetWordFrequencies(document_id)) {
+            term_ids.push_back(terms_.Find(word));
+            freqs.push_back(freq);
+        }
+        offsets.push_back(term_ids.size());
+    }
+    writer.WriteSection<uint64_t>(IndexSection::WORD_FREQ_OFFSETS, offsets);
+    writer.WriteSection<TermId>(IndexSection::WORD_FREQ_TERM_IDS, term_ids);
+    writer.WriteSection<double>(IndexSection::WORD_FREQ_VALUES, freqs);
+    // The log is dropped only after the index which replaces it is durable
+    writer.Finish();
+    if (log_ != nullptr) {
+        log_->Truncate();
+    }
+}
+
+void SearchServer::OpenLog(const string& path, WriteAheadLogOptions options) {
+    // Replayed mutations are not logged again, the log is attached afterwards
+    auto log = make_unique<WriteAheadLog>(path, options, [this](const LogRecord& record) {
+        if (record.sequence_number <= log_sequence_number_) {
+            return;
+        }
+        if (record.type == LogRecordType::ADD_DOCUMENT) {
+            AddDocument(record.document_id, record.text, record.status, record.ratings);
+        } else {
+            RemoveDocument(record.document_id);
+        }
+        log_sequence_number_ = record.sequence_number;
+    });
+    lock_guard guard(write_mutex_);
+    log_ = move(log);
+}
+
+void SearchServer::SyncLog() {
+    // Writers are not blocked while the batch is synced
+    WriteAheadLog* log;
+    {
+        lock_guard guard(write_mutex_);
+        log = log_.get();
+    }
+    if (log != nullptr) {
+        log->Sync();
+    }
+}
+
 void SearchServer::AddDocument(int document_id, string_view document, DocumentStatus status,
                                const vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    lock_guard guard(write_mutex_);
+    if ((document_id < 0) || (document_ids_.count(document_id) > 0)) {
         throw std::invalid_argument("Invalid document_id"s);
     }
-    document_to_words_.emplace_back(document.begin(), document.end());
-    vector<string_view> words = SplitIntoWordsNoStop(document_to_words_.back());
-    const double inv_word_count = 1.0 / words.size();
-    for (string_view word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        id_to_word_freqs_[document_id][word] += inv_word_count;
+    const TokenizedDocument tokenized = TokenizeDocument(document);
+    if (log_ != nullptr) {
+        log_->AppendAddDocument(++log_sequence_number_, document_id, document, status, ratings);
     }
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
-    document_ids_.insert(document_id);
+    IndexDraft draft = BeginWrite();
+    IndexDocument(draft, document_id, tokenized, status, ComputeAverageRating(ratings));
+    Publish(draft);
 }
 
 set<int>::const_iterator SearchServer::begin() const {
@@ -39,53 +166,348 @@ set<int>::const_iterator SearchServer::end() const {
 }
 
 vector<Document> SearchServer::FindTopDocuments(string_view raw_query,
-                                                DocumentStatus status) const {
-    return FindTopDocuments(
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
-        });
+                                                DocumentStatus status,
+                                                const SearchOptions& options) const {
+    return FindTopDocuments(execution::seq, raw_query, status, options);
+}
+
+vector<Document> SearchServer::FindTopDocuments(string_view raw_query,
+                                                const SearchOptions& options) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL, options);
+}
+
+vector<vector<Document>> SearchServer::FindTopDocumentsBatch(
+    const vector<string>& raw_queries) const {
+    const shared_ptr<ThreadPool> thread_pool = GetThreadPool();
+    vector<Query> queries(raw_queries.size());
+    thread_pool->ParallelFor(raw_queries.size(), [this, &raw_queries, &queries](size_t index) {
+        queries[index] = ParseQuery(raw_queries[index]);
+    });
+
+    // Distinct words of the batch, queries refer to them by index
+    vector<string_view> words;
+    for (const Query& query : queries) {
+        words.insert(words.end(), query.plus_words.begin(), query.plus_words.end());
+        words.insert(words.end(), query.minus_words.begin(), query.minus_words.end());
+    }
+    sort(words.begin(), words.end());
+    words.erase(unique(words.begin(), words.end()), words.end());
+    vector<TermId> term_ids(words.size());
+    shared_ptr<const IndexSnapshot> snapshot_ptr;
+    {
+        shared_lock terms_guard(terms_mutex_);
+        snapshot_ptr = GetSnapshot();
+        for (size_t i = 0; i < words.size(); ++i) {
+            term_ids[i] = terms_.Find(words[i]);
+        }
+    }
+    const IndexSnapshot& snapshot = *snapshot_ptr;
+    const auto find_word = [&words](string_view word) {
+        return static_cast<size_t>(lower_bound(words.begin(), words.end(), word) - words.begin());
+    };
+
+    struct BatchQuery {
+        // Sorted like the words of the query
+        vector<size_t> plus_words;
+        vector<size_t> minus_words;
+    };
+    vector<BatchQuery> batch_queries(queries.size());
+    vector<char> is_plus_word(words.size());
+    vector<char> is_minus_word(words.size());
+    vector<double> inverse_document_freqs(words.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        for (string_view word : queries[i].plus_words) {
+            const size_t word_index = find_word(word);
+            const TermId term_id = term_ids[word_index];
+            if (term_id != INVALID_TERM_ID && snapshot.GetTermDocumentCount(term_id) > 0) {
+                batch_queries[i].plus_words.push_back(word_index);
+                is_plus_word[word_index] = true;
+                inverse_document_freqs[word_index] = snapshot.GetInverseDocumentFreq(term_id);
+            }
+        }
+        for (string_view word : queries[i].minus_words) {
+            const size_t word_index = find_word(word);
+            if (term_ids[word_index] != INVALID_TERM_ID) {
+                batch_queries[i].minus_words.push_back(word_index);
+                is_minus_word[word_index] = true;
+            }
+        }
+    }
+
+    const vector<QueryPartition> partitions =
+        MakeQueryPartitions(snapshot, BATCH_PARTITION_DOCUMENT_COUNT);
+    // Matched documents of the partitions, grouped by query
+    struct PartitionDocuments {
+        vector<Document> documents;
+        vector<size_t> query_ends;
+    };
+    vector<PartitionDocuments> partition_documents(partitions.size());
+    thread_pool->ParallelFor(partitions.size(), [&](size_t partition_index) {
+        const QueryPartition& partition = partitions[partition_index];
+        const DocumentColumns documents = partition.segment->GetDocuments();
+        const int first_ordinal = partition.segment->GetFirstOrdinal();
+        // Postings of the partition as offsets from its beginning, decoded once for all
+        // queries. Plus postings carry the relevance they add.
+        vector<pair<uint32_t, double>> plus_postings;
+        vector<uint32_t> minus_postings;
+        vector<pair<size_t, size_t>> plus_ranges(words.size());
+        vector<pair<size_t, size_t>> minus_ranges(words.size());
+        for (size_t word_index = 0; word_index < words.size(); ++word_index) {
+            if (!is_plus_word[word_index] && !is_minus_word[word_index]) {
+                continue;
+            }
+            plus_ranges[word_index].first = plus_postings.size();
+            minus_ranges[word_index].first = minus_postings.size();
+            PostingCursor cursor(partition.segment->GetPostings(term_ids[word_index]));
+            for (cursor.Advance(partition.ordinal_begin);
+                 cursor.GetDocumentId() < partition.ordinal_end; cursor.Next()) {
+                const int ordinal = cursor.GetDocumentId();
+                const uint32_t offset = static_cast<uint32_t>(ordinal - partition.ordinal_begin);
+                const int index = ordinal - first_ordinal;
+                if (is_minus_word[word_index]) {
+                    minus_postings.push_back(offset);
+                }
+                if (is_plus_word[word_index]
+                    && documents.statuses[index] == DocumentStatus::ACTUAL) {
+                    const double term_freq =
+                        cursor.GetTermCount() * documents.inv_word_counts[index];
+                    plus_postings.push_back(
+                        {offset, term_freq * inverse_document_freqs[word_index]});
+                }
+            }
+            plus_ranges[word_index].second = plus_postings.size();
+            minus_ranges[word_index].second = minus_postings.size();
+        }
+        vector<uint32_t> removed_offsets;
+        snapshot.tombstones->ForEach(
+            partition.ordinal_begin, partition.ordinal_end, [&](int ordinal) {
+                removed_offsets.push_back(static_cast<uint32_t>(ordinal - partition.ordinal_begin));
+            });
+
+        PartitionDocuments& matched = partition_documents[partition_index];
+        size_t posting_count = 0;
+        for (const BatchQuery& query : batch_queries) {
+            for (size_t word_index : query.plus_words) {
+                posting_count += plus_ranges[word_index].second - plus_ranges[word_index].first;
+            }
+        }
+        matched.documents.reserve(posting_count);
+        matched.query_ends.reserve(batch_queries.size());
+        RelevanceAccumulator& accumulator = RelevanceAccumulator::GetThreadLocal();
+        for (const BatchQuery& query : batch_queries) {
+            bool has_postings = false;
+            for (size_t word_index : query.plus_words) {
+                has_postings |= plus_ranges[word_index].first < plus_ranges[word_index].second;
+            }
+            if (!has_postings) {
+                matched.query_ends.push_back(matched.documents.size());
+                continue;
+            }
+            accumulator.Reset(partition.ordinal_end - partition.ordinal_begin);
+            for (size_t word_index : query.plus_words) {
+                for (size_t i = plus_ranges[word_index].first; i < plus_ranges[word_index].second;
+                     ++i) {
+                    accumulator.Add(plus_postings[i].first, plus_postings[i].second);
+                }
+            }
+            for (uint32_t offset : removed_offsets) {
+                accumulator.Exclude(offset);
+            }
+            vector<uint32_t>& offsets = accumulator.GetScored();
+            for (size_t word_index : query.minus_words) {
+                const ArrayView<uint32_t> minus_offsets(
+                    minus_postings.data() + minus_ranges[word_index].first,
+                    minus_ranges[word_index].second - minus_ranges[word_index].first);
+                offsets.resize(SubtractIds(offsets, minus_offsets, offsets.data()));
+            }
+            for (uint32_t offset : offsets) {
+                const int index = partition.ordinal_begin + static_cast<int>(offset)
+                                  - first_ordinal;
+                matched.documents.push_back({documents.ids[index],
+                                             accumulator.GetRelevance(offset),
+                                             documents.ratings[index]});
+            }
+            matched.query_ends.push_back(matched.documents.size());
+        }
+    });
+
+    // Partitions go in ordinal order, as the documents of a single query do
+    vector<vector<Document>> results(queries.size());
+    thread_pool->ParallelFor(queries.size(), [&partition_documents, &results](size_t i) {
+        vector<Document> matched_documents;
+        for (const PartitionDocuments& matched : partition_documents) {
+            const size_t begin = i == 0 ? 0 : matched.query_ends[i - 1];
+            matched_documents.insert(matched_documents.end(),
+                                     matched.documents.begin() + begin,
+                                     matched.documents.begin() + matched.query_ends[i]);
+        }
+        results[i] = SelectTopDocuments(move(matched_documents), {});
+    });
+    return results;
+}
+
+future<SearchResult> SearchServer::FindTopDocumentsAsync(string raw_query,
+                                                         DocumentStatus status,
+                                                         const SearchOptions& options,
+                                                         CancellationToken token) const {
+    SearchOptions query_options = options;
+    if (token.CanBeCancelled()) {
+        query_options.budget.cancellation = move(token);
+    }
+    const CancellationToken cancellation = query_options.budget.cancellation;
+    return RunQueryAsync([this, raw_query = move(raw_query), status, query_options]() {
+        return Search(raw_query, status, query_options);
+    }, cancellation);
+}
+
+future<SearchResult> SearchServer::FindTopDocumentsAsync(PreparedQuery query,
+                                                         DocumentStatus status,
+                                                         const SearchOptions& options,
+                                                         CancellationToken token) const {
+    SearchOptions query_options = options;
+    if (token.CanBeCancelled()) {
+        query_options.budget.cancellation = move(token);
+    }
+    const CancellationToken cancellation = query_options.budget.cancellation;
+    return RunQueryAsync([this, query = move(query), status, query_options]() {
+        return Search(query, status, query_options);
+    }, cancellation);
 }
 
-vector<Document> SearchServer::FindTopDocuments(string_view raw_query) const {
-    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+future<SearchResult> SearchServer::RunQueryAsync(function<SearchResult()> query,
+                                                 CancellationToken token) const {
+    // Releases the count of a query which did not get queued
+    struct AsyncQueryGuard {
+        const SearchServer* server;
+
+        ~AsyncQueryGuard() {
+            if (server != nullptr) {
+                server->FinishAsyncQuery();
+            }
+        }
+    };
+
+    const auto result = make_shared<promise<SearchResult>>();
+    future<SearchResult> search_result = result->get_future();
+    {
+        lock_guard guard(async_query_mutex_);
+        ++async_query_count_;
+    }
+    AsyncQueryGuard guard{this};
+    GetThreadPool()->Submit([this, query = move(query), token = move(token), result]() {
+        try {
+            token.ThrowIfCancelled();
+            SearchResult search_result = query();
+            // The token stops a running scan through the budget of the query
+            if (search_result.is_partial && token.IsCancelled()) {
+                throw QueryCancelledError();
+            }
+            result->set_value(move(search_result));
+        } catch (...) {
+            result->set_exception(current_exception());
+        }
+        FinishAsyncQuery();
+    });
+    guard.server = nullptr;
+    return search_result;
+}
+
+void SearchServer::FinishAsyncQuery() const {
+    // Notified under the lock, so the destructor can not free the condition first
+    lock_guard guard(async_query_mutex_);
+    if (--async_query_count_ == 0) {
+        async_queries_finished_.notify_all();
+    }
+}
+
+PreparedQuery SearchServer::PrepareQuery(string_view raw_query) const {
+    PreparedQuery prepared;
+    prepared.text_ = make_shared<const string>(raw_query);
+    Query query = ParseQuery(*prepared.text_);
+    ResolvedQuery resolved = ResolveQuery(query);
+    prepared.plus_words_ = move(query.plus_words);
+    prepared.minus_words_ = move(query.minus_words);
+    prepared.epoch_ = resolved.snapshot->epoch;
+    prepared.plus_terms_ = move(resolved.plus_terms);
+    prepared.minus_terms_ = move(resolved.minus_terms);
+    return prepared;
+}
+
+vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query,
+                                                DocumentStatus status,
+                                                const SearchOptions& options) const {
+    return FindTopDocuments(execution::seq, query, status, options);
+}
+
+vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query,
+                                                const SearchOptions& options) const {
+    return FindTopDocuments(query, DocumentStatus::ACTUAL, options);
+}
+
+SearchResult SearchServer::Search(string_view raw_query, DocumentStatus status,
+                                  const SearchOptions& options) const {
+    const Query query = ParseQuery(raw_query);
+    return Search(execution::seq, query.plus_words, query.minus_words, ResolveQuery(query),
+                  status, options);
+}
+
+SearchResult SearchServer::Search(const PreparedQuery& query, DocumentStatus status,
+                                  const SearchOptions& options) const {
+    return Search(execution::seq, query.plus_words_, query.minus_words_, ResolveQuery(query),
+                  status, options);
+}
+
+uint64_t SearchServer::GetPartialQueryCount() const {
+    return partial_query_count_.load(memory_order_relaxed);
 }
 
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return GetSnapshot()->document_count;
 }
 
 const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    auto it = id_to_word_freqs_.find(document_id);
     const static map<string_view, double> empty_map = {};
+    lock_guard guard(word_freqs_mutex_);
+    auto it = id_to_word_freqs_.find(document_id);
     if (it != id_to_word_freqs_.end()) {
         return (*it).second;
     }
-    return empty_map;
+    if (index_file_ == nullptr || document_ids_.count(document_id) == 0) {
+        return empty_map;
+    }
+    return id_to_word_freqs_.emplace(document_id, LoadWordFrequencies(document_id))
+        .first->second;
 }
 
-tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_view raw_query,
-                                                                       int document_id) const {
-    const auto query = ParseQuery(raw_query);
-    if (any_of(
-        query.minus_words.begin(),
-        query.minus_words.end(),
-        [this, document_id](string_view minus_word) {
-            return word_to_document_freqs_.count(minus_word) != 0 &&
-            word_to_document_freqs_.at(minus_word).count(document_id);
-        }
-    )) {
-        return {vector<string_view>{}, documents_.at(document_id).status};
+map<string_view, double> SearchServer::LoadWordFrequencies(int document_id) const {
+    const auto id_to_ordinal = index_file_->GetSection<pair<int, int>>(
+        IndexSection::ID_TO_ORDINAL);
+    const auto offsets = index_file_->GetSection<uint64_t>(IndexSection::WORD_FREQ_OFFSETS);
+    const auto term_ids = index_file_->GetSection<TermId>(IndexSection::WORD_FREQ_TERM_IDS);
+    const auto freqs = index_file_->GetSection<double>(IndexSection::WORD_FREQ_VALUES);
+    const auto it = lower_bound(id_to_ordinal.begin(), id_to_ordinal.end(),
+                                pair{document_id, numeric_limits<int>::min()});
+    const size_t index = it->second - index_file_->GetFirstOrdinal();
+    // Checked here rather than on open, so only the pages of the document are read
+    const auto term_offsets = index_file_->GetSection<uint64_t>(IndexSection::TERM_OFFSETS);
+    const size_t term_count = term_offsets.empty() ? 0 : term_offsets.size() - 1;
+    if (offsets[index] > offsets[index + 1] || offsets[index + 1] > term_ids.size()) {
+        throw runtime_error("Invalid word frequencies in index file"s);
     }
-    vector<string_view> matched_words;
-    for (string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.push_back(word);
+    map<string_view, double> word_freqs;
+    for (uint64_t i = offsets[index]; i < offsets[index + 1]; ++i) {
+        if (term_ids[i] >= term_count) {
+            throw runtime_error("Invalid word frequencies in index file"s);
         }
+        word_freqs.emplace_hint(word_freqs.end(), terms_.GetTerm(term_ids[i]), freqs[i]);
     }
-    return {matched_words, documents_.at(document_id).status};
+    return word_freqs;
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_view raw_query,
+                                                                       int document_id) const {
+    const auto query = ParseQuery(raw_query);
+    return MatchDocument(execution::seq, query.plus_words, ResolveQuery(query), document_id);
 }
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(
@@ -102,55 +524,178 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(
     int document_id
 ) const {
     const auto query = ParseQueryPar(raw_query);
-    if (any_of(
-        policy,
-        query.minus_words.begin(),
-        query.minus_words.end(),
-        [this, document_id](string_view minus_word) {
-            return word_to_document_freqs_.count(minus_word) != 0 &&
-            word_to_document_freqs_.at(minus_word).count(document_id);
-        }
-    )) {
-        return {vector<string_view>{}, documents_.at(document_id).status};
-    }
-    vector<string_view> matched_words(query.plus_words.size());
-    auto it_last = copy_if(
-        policy,
-        query.plus_words.begin(),
-        query.plus_words.end(),
-        matched_words.begin(),
-        [this, document_id](string_view plus_word) {
-            return word_to_document_freqs_.count(plus_word) != 0 &&
-            word_to_document_freqs_.at(plus_word).count(document_id);
-        }
-    );
-    sort(policy, matched_words.begin(), it_last);
-    auto it_last_new = unique(policy, matched_words.begin(), it_last);
-    matched_words.erase(it_last_new, matched_words.end());
-    return {matched_words, documents_.at(document_id).status};
+    return MatchDocument(policy, query.plus_words, ResolveQuery(query), document_id);
 }
 
-void SearchServer::RemoveDocument(int document_id) {
-    if (document_ids_.find(document_id) == document_ids_.end()) {
-        return;
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const PreparedQuery& query,
+                                                                       int document_id) const {
+    return MatchDocument(execution::seq, query.plus_words_, ResolveQuery(query), document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(
+    const execution::sequenced_policy&,
+    const PreparedQuery& query,
+    int document_id
+) const {
+    return MatchDocument(query, document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(
+    const execution::parallel_policy& policy,
+    const PreparedQuery& query,
+    int document_id
+) const {
+    return MatchDocument(policy, query.plus_words_, ResolveQuery(query), document_id);
+}
+
+template <typename ExecutionPolicy>
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(
+    const ExecutionPolicy& policy,
+    const vector<string_view>& plus_words,
+    const ResolvedQuery& query,
+    int document_id
+) const {
+    const auto [segment, ordinal] = query.snapshot->FindDocument(document_id);
+    if (segment == nullptr) {
+        throw out_of_range("Invalid document_id"s);
+    }
+    const DocumentStatus status =
+        segment->GetDocuments().statuses[ordinal - segment->GetFirstOrdinal()];
+    vector<char> is_excluded(query.minus_terms.size());
+    ForEachIndex(policy, query.minus_terms.size(),
+                 [&query, &is_excluded, segment = segment, ordinal = ordinal](size_t i) {
+                     is_excluded[i] = ContainsTerm(*segment, query.minus_terms[i], ordinal);
+                 });
+    if (find(is_excluded.begin(), is_excluded.end(), true) != is_excluded.end()) {
+        return {vector<string_view>{}, status};
     }
-    for (auto& [word, id_freq] : word_to_document_freqs_) {
-        auto it = id_freq.find(document_id);
-        if (it != id_freq.end()) {
-            id_freq.erase(it);
+    vector<char> is_matched(plus_words.size());
+    ForEachIndex(policy, query.plus_terms.size(),
+                 [&query, &is_matched, segment = segment, ordinal = ordinal](size_t i) {
+                     is_matched[i] = ContainsTerm(*segment, query.plus_terms[i], ordinal);
+                 });
+    vector<string_view> matched_words;
+    for (size_t i = 0; i < plus_words.size(); ++i) {
+        if (is_matched[i]) {
+            matched_words.push_back(plus_words[i]);
         }
     }
-    {
-        auto it = documents_.find(document_id);
-        if (it != documents_.end()) {
-            documents_.erase(it);
+    // Words of a query parsed in parallel are not deduplicated
+    if constexpr (is_same_v<ExecutionPolicy, execution::parallel_policy>) {
+        sort(matched_words.begin(), matched_words.end());
+        auto it_last_new = unique(matched_words.begin(), matched_words.end());
+        matched_words.erase(it_last_new, matched_words.end());
+    }
+    return {matched_words, status};
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+    string_view raw_query,
+    const vector<int>& document_ids
+) const {
+    return MatchDocuments(execution::seq, ParseQuery(raw_query), document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+    const execution::sequenced_policy&,
+    string_view raw_query,
+    const vector<int>& document_ids
+) const {
+    return MatchDocuments(raw_query, document_ids);
+}
+
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+    const execution::parallel_policy& policy,
+    string_view raw_query,
+    const vector<int>& document_ids
+) const {
+    return MatchDocuments(policy, ParseQuery(raw_query), document_ids);
+}
+
+template <typename ExecutionPolicy>
+vector<tuple<vector<string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+    const ExecutionPolicy& policy,
+    const Query& query,
+    const vector<int>& document_ids
+) const {
+    const ResolvedQuery resolved = ResolveQuery(query);
+    struct DocumentPlace {
+        int ordinal;
+        size_t position;
+        const IndexSegment* segment;
+    };
+    vector<DocumentPlace> places;
+    places.reserve(document_ids.size());
+    for (size_t position = 0; position < document_ids.size(); ++position) {
+        const auto [segment, ordinal] = resolved.snapshot->FindDocument(document_ids[position]);
+        if (segment == nullptr) {
+            throw out_of_range("Invalid document_id"s);
         }
+        places.push_back({ordinal, position, segment});
     }
-    {
-        auto it = find(document_ids_.begin(),
-                       document_ids_.end(), document_id);
-        document_ids_.erase(it);
+    sort(places.begin(), places.end(), [](const DocumentPlace& lhs, const DocumentPlace& rhs) {
+        return lhs.ordinal < rhs.ordinal;
+    });
+
+    vector<tuple<vector<string_view>, DocumentStatus>> results(document_ids.size());
+    vector<uint32_t> indexes;
+    vector<vector<uint32_t>> matched_indexes(resolved.plus_terms.size());
+    // Segments hold contiguous ordinals, so the documents of a segment form a run
+    for (auto run_begin = places.begin(); run_begin != places.end();) {
+        const IndexSegment& segment = *run_begin->segment;
+        const int first_ordinal = segment.GetFirstOrdinal();
+        const auto run_end = find_if(run_begin, places.end(), [&segment](const DocumentPlace& place) {
+            return place.segment != &segment;
+        });
+        const DocumentColumns documents = segment.GetDocuments();
+        indexes.clear();
+        for (auto place = run_begin; place != run_end; ++place) {
+            const uint32_t index = static_cast<uint32_t>(place->ordinal - first_ordinal);
+            get<1>(results[place->position]) = documents.statuses[index];
+            // A document may be asked for more than once
+            if (indexes.empty() || indexes.back() != index) {
+                indexes.push_back(index);
+            }
+        }
+        SubtractPostings(segment, resolved.minus_terms, first_ordinal, indexes);
+        ForEachIndex(policy, resolved.plus_terms.size(),
+            [&resolved, &matched_indexes, &segment, &indexes, first_ordinal](size_t i) {
+                vector<uint32_t>& matched = matched_indexes[i];
+                matched.clear();
+                if (resolved.plus_terms[i] != INVALID_TERM_ID) {
+                    matched = indexes;
+                    FilterIndexes(segment.GetPostings(resolved.plus_terms[i]), first_ordinal,
+                                  true, matched);
+                }
+            });
+        // Words are appended in the order of the query, which is sorted
+        for (size_t i = 0; i < query.plus_words.size(); ++i) {
+            auto place = run_begin;
+            for (uint32_t index : matched_indexes[i]) {
+                const int ordinal = first_ordinal + static_cast<int>(index);
+                while (place->ordinal < ordinal) {
+                    ++place;
+                }
+                for (; place != run_end && place->ordinal == ordinal; ++place) {
+                    get<0>(results[place->position]).push_back(query.plus_words[i]);
+                }
+            }
+        }
+        run_begin = run_end;
     }
+    return results;
+}
+
+void SearchServer::RemoveDocument(int document_id) {
+    lock_guard guard(write_mutex_);
+    if (document_ids_.find(document_id) == document_ids_.end()) {
+        return;
+    }
+    vector<TermId> term_ids;
+    for (const auto& [word, _] : GetWordFrequencies(document_id)) {
+        term_ids.push_back(terms_.Find(word));
+    }
+    RemoveIndexedDocument(document_id, term_ids);
 }
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
@@ -158,29 +703,55 @@ void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int d
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy& policy, int document_id) {
+    lock_guard guard(write_mutex_);
     if (document_ids_.find(document_id) == document_ids_.end()) {
         return;
     }
-    vector<string_view> words_to_delete(id_to_word_freqs_.at(document_id).size());
-    transform(policy, id_to_word_freqs_.at(document_id).begin(), 
-              id_to_word_freqs_.at(document_id).end(), words_to_delete.begin(), 
-              [](auto word_freq) {
-                  return word_freq.first;
-              });
-    for_each(policy, words_to_delete.begin(), words_to_delete.end(),
-             [this, document_id](string_view word) {
-                 word_to_document_freqs_.at(word).erase(document_id);
-             });
-    {
-        auto it = documents_.find(document_id);
-        if (it != documents_.end()) {
-            documents_.erase(it);
-        }
+    vector<string_view> words;
+    for (const auto& [word, _] : GetWordFrequencies(document_id)) {
+        words.push_back(word);
     }
-    {
-        auto it = find(document_ids_.begin(),
-                       document_ids_.end(), document_id);
-        document_ids_.erase(it);
+    vector<TermId> term_ids(words.size());
+    ForEachIndex(policy, words.size(), [this, &words, &term_ids](size_t i) {
+        term_ids[i] = terms_.Find(words[i]);
+    });
+    RemoveIndexedDocument(document_id, term_ids);
+}
+
+void SearchServer::SetResultCacheCapacity(size_t entry_count) {
+    shared_ptr<ResultCache> cache;
+    if (entry_count > 0) {
+        cache = make_shared<ResultCache>(entry_count, RESULT_CACHE_SHARD_COUNT);
+    }
+    atomic_store(&result_cache_, cache);
+}
+
+ResultCacheStats SearchServer::GetResultCacheStats() const {
+    const shared_ptr<ResultCache> cache = atomic_load(&result_cache_);
+    return cache == nullptr ? ResultCacheStats{} : cache->GetStats();
+}
+
+void SearchServer::SetThreadPoolOptions(ThreadPoolOptions options) {
+    auto thread_pool = ThreadPool::Create(options);
+    lock_guard guard(thread_pool_mutex_);
+    thread_pool_ = move(thread_pool);
+}
+
+shared_ptr<ThreadPool> SearchServer::GetThreadPool() const {
+    lock_guard guard(thread_pool_mutex_);
+    if (thread_pool_ == nullptr) {
+        thread_pool_ = ThreadPool::Create();
+    }
+    return thread_pool_;
+}
+
+void SearchServer::SetMutableSegmentSize(int document_count) {
+    lock_guard guard(write_mutex_);
+    mutable_segment_size_ = max(document_count, 1);
+    IndexDraft draft = BeginWrite();
+    if (draft.mutable_segment->GetDocumentCount() >= mutable_segment_size_) {
+        SealMutableSegment(draft);
+        Publish(draft);
     }
 }
 
@@ -196,7 +767,7 @@ bool SearchServer::IsValidWord(string_view word) {
     });
 }
 
-vector<string_view> SearchServer::SplitIntoWordsNoStop(const string& text) const {
+vector<string_view> SearchServer::SplitIntoWordsNoStop(string_view text) const {
     vector<string_view> words;
     for (string_view word : SplitIntoWordsSTRV(text)) {
         if (!IsValidWord(word)) {
@@ -209,6 +780,51 @@ vector<string_view> SearchServer::SplitIntoWordsNoStop(const string& text) const
     return words;
 }
 
+SearchServer::TokenizedDocument SearchServer::TokenizeDocument(string_view text) const {
+    vector<string_view> words = SplitIntoWordsNoStop(text);
+    TokenizedDocument result;
+    result.inv_word_count = 1.0 / words.size();
+    sort(words.begin(), words.end());
+    for (auto it = words.begin(); it != words.end();) {
+        auto run_end = upper_bound(it, words.end(), *it);
+        result.word_counts.push_back({*it, static_cast<uint32_t>(run_end - it)});
+        it = run_end;
+    }
+    return result;
+}
+
+void SearchServer::IndexDocument(IndexDraft& draft, int document_id,
+                                 const TokenizedDocument& document, DocumentStatus status,
+                                 int rating) {
+    vector<pair<TermId, uint32_t>> term_counts;
+    term_counts.reserve(document.word_counts.size());
+    {
+        lock_guard terms_guard(terms_mutex_);
+        for (const auto& [word, term_count] : document.word_counts) {
+            term_counts.push_back({terms_.Intern(word), term_count});
+        }
+    }
+    map<string_view, double> word_freqs;
+    for (const auto& [term_id, term_count] : term_counts) {
+        word_freqs.emplace_hint(word_freqs.end(), terms_.GetTerm(term_id),
+                                term_count * document.inv_word_count);
+    }
+    {
+        lock_guard word_freqs_guard(word_freqs_mutex_);
+        id_to_word_freqs_.emplace(document_id, move(word_freqs));
+        document_ids_.insert(document_id);
+    }
+    draft.mutable_segment->AddDocument(document_id, status, rating, document.inv_word_count,
+                                       term_counts);
+    for (const auto& [term_id, _] : term_counts) {
+        draft.snapshot.term_statistics.AddDocuments(term_id, 1);
+    }
+    ++draft.snapshot.document_count;
+    if (draft.mutable_segment->GetDocumentCount() >= mutable_segment_size_) {
+        SealMutableSegment(draft);
+    }
+}
+
 int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     if (ratings.empty()) {
         return 0;
@@ -270,8 +886,452 @@ SearchServer::Query SearchServer::ParseQueryPar(string_view text) const {
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+vector<SearchServer::QueryPartition> SearchServer::MakeQueryPartitions(
+    const IndexSnapshot& snapshot, int partition_document_count) {
+    vector<QueryPartition> partitions;
+    for (const IndexSegment* segment : snapshot.GetSegments()) {
+        const int ordinal_end = segment->GetOrdinalEnd();
+        for (int ordinal = segment->GetFirstOrdinal(); ordinal < ordinal_end;
+             ordinal += partition_document_count) {
+            partitions.push_back(
+                {segment, ordinal, min(ordinal + partition_document_count, ordinal_end)});
+        }
+    }
+    return partitions;
+}
+
+shared_ptr<const IndexSnapshot> SearchServer::MakeEmptySnapshot() {
+    IndexSnapshot snapshot;
+    snapshot.mutable_segment = make_shared<MutableSegment>(0);
+    snapshot.tombstones = make_shared<const Tombstones>();
+    snapshot.epoch = MakeSnapshotEpoch();
+    return make_shared<const IndexSnapshot>(move(snapshot));
+}
+
+shared_ptr<const IndexSnapshot> SearchServer::GetSnapshot() const {
+    return atomic_load(&snapshot_);
+}
+
+SearchServer::IndexDraft SearchServer::BeginWrite() const {
+    IndexDraft draft{*GetSnapshot(), nullptr, {}};
+    // Posting lists are shared with the published segment until they are changed
+    draft.mutable_segment = make_shared<MutableSegment>(*draft.snapshot.mutable_segment);
+    draft.snapshot.mutable_segment = draft.mutable_segment;
+    return draft;
+}
+
+void SearchServer::Publish(IndexDraft& draft) {
+    draft.snapshot.mutable_segment = draft.mutable_segment;
+    draft.snapshot.log_document_count = log(draft.snapshot.document_count);
+    draft.snapshot.epoch = MakeSnapshotEpoch();
+    auto snapshot = make_shared<const IndexSnapshot>(move(draft.snapshot));
+    atomic_store(&snapshot_, snapshot);
+    if (draft.removed_term_ids.empty()) {
+        return;
+    }
+    // Terms are released after the snapshot without their postings is published,
+    // so readers never see a reused term id in an older snapshot
+    ReleaseUnusedTerms(*snapshot, draft.removed_term_ids);
+    draft.removed_term_ids.clear();
+}
+
+SearchServer::ResolvedQuery SearchServer::ResolveQuery(const Query& query) const {
+    ResolvedQuery result;
+    result.plus_terms.reserve(query.plus_words.size());
+    result.minus_terms.reserve(query.minus_words.size());
+    shared_lock terms_guard(terms_mutex_);
+    result.snapshot = GetSnapshot();
+    for (string_view word : query.plus_words) {
+        result.plus_terms.push_back(terms_.Find(word));
+    }
+    for (string_view word : query.minus_words) {
+        result.minus_terms.push_back(terms_.Find(word));
+    }
+    return result;
+}
+
+string SearchServer::MakeResultCacheKey(const vector<string_view>& plus_words,
+                                        const vector<string_view>& minus_words,
+                                        DocumentStatus status, const SearchOptions& options) {
+    // Words have no spaces and plus words do not start with a minus
+    string key;
+    for (string_view word : plus_words) {
+        key.append(word).push_back(' ');
+    }
+    for (string_view word : minus_words) {
+        key.append("-"s).append(word).push_back(' ');
+    }
+    key.append(to_string(static_cast<int>(status))).push_back(' ');
+    key.append(to_string(options.offset)).push_back(' ');
+    key.append(to_string(options.count)).push_back(' ');
+    key.append(to_string(static_cast<int>(options.mode)));
+    return key;
+}
+
+SearchServer::ResolvedQuery SearchServer::ResolveQuery(const PreparedQuery& query) const {
+    ResolvedQuery result;
+    result.snapshot = GetSnapshot();
+    if (result.snapshot->epoch != query.epoch_) {
+        // Term ids may have been released or assigned since the query was prepared
+        return ResolveQuery(Query{query.plus_words_, query.minus_words_});
+    }
+    result.plus_terms = query.plus_terms_;
+    result.minus_terms = query.minus_terms_;
+    return result;
+}
+
+void SearchServer::SealMutableSegment(IndexDraft& draft) {
+    auto& sealed_segments = draft.snapshot.sealed_segments;
+    auto sealed = make_shared<const SealedSegment>(
+        vector<const IndexSegment*>{draft.mutable_segment.get()}, [](int) { return false; });
+    if (sealed->GetDocumentCount() > 0) {
+        sealed_segments.push_back(move(sealed));
+        RequestMerge();
+    }
+    draft.mutable_segment = make_shared<MutableSegment>(
+        sealed_segments.empty() ? 0 : sealed_segments.back()->GetOrdinalEnd());
+    draft.snapshot.mutable_segment = draft.mutable_segment;
+}
+
+void SearchServer::MergeSegments() {
+    while (true) {
+        const auto snapshot = GetSnapshot();
+        const auto& sealed_segments = snapshot->sealed_segments;
+        // Segments of similar size are merged, so their number grows logarithmically.
+        // The pair nearest to the end goes first, it is the smallest one.
+        size_t index = sealed_segments.size();
+        for (size_t i = sealed_segments.size(); i >= 2; --i) {
+            if (sealed_segments[i - 2]->GetLiveDocumentCount()
+                <= sealed_segments[i - 1]->GetLiveDocumentCount()) {
+                index = i - 2;
+                break;
+            }
+        }
+        if (index == sealed_segments.size()) {
+            return;
+        }
+        const auto previous = sealed_segments[index];
+        const auto last = sealed_segments[index + 1];
+        // Removed documents of the merged segments are purged on the way
+        const Tombstones& tombstones = *snapshot->tombstones;
+        auto merged = make_shared<const SealedSegment>(
+            vector<const IndexSegment*>{previous.get(), last.get()},
+            [&tombstones](int ordinal) { return tombstones.Contains(ordinal); });
+
+        lock_guard guard(write_mutex_);
+        IndexDraft draft = BeginWrite();
+        auto& current_segments = draft.snapshot.sealed_segments;
+        auto it = find(current_segments.begin(), current_segments.end(), previous);
+        // A purge or a writer replaced the segments meanwhile, the merge starts anew
+        if (it == current_segments.end() || next(it) == current_segments.end()
+            || *next(it) != last) {
+            continue;
+        }
+        // Documents removed since the snapshot are in the merged segment, their tombstones
+        // move to the new ordinals
+        const Tombstones& current_tombstones = *draft.snapshot.tombstones;
+        auto merged_tombstones = make_shared<Tombstones>(current_tombstones);
+        vector<pair<int, vector<TermId>>> moved_tombstones;
+        for (const SealedSegment* source : {previous.get(), last.get()}) {
+            current_tombstones.ForEach(
+                source->GetFirstOrdinal(), source->GetOrdinalEnd(), [&](int ordinal) {
+                    merged_tombstones->Erase(ordinal);
+                    vector<TermId> term_ids = move(tombstone_term_ids_.extract(ordinal).mapped());
+                    if (tombstones.Contains(ordinal)) {
+                        draft.removed_term_ids.insert(draft.removed_term_ids.end(),
+                                                      term_ids.begin(), term_ids.end());
+                        return;
+                    }
+                    const int document_id =
+                        source->GetDocuments().ids[ordinal - source->GetFirstOrdinal()];
+                    moved_tombstones.push_back({merged->FindOrdinal(document_id), move(term_ids)});
+                });
+        }
+        for (auto& [ordinal, term_ids] : moved_tombstones) {
+            merged_tombstones->Add(ordinal);
+            tombstone_term_ids_.emplace(ordinal, move(term_ids));
+        }
+        draft.snapshot.tombstones = move(merged_tombstones);
+        if (!moved_tombstones.empty()) {
+            RequestPurge();
+        }
+        it = current_segments.erase(next(it)) - 1;
+        if (merged->GetDocumentCount() > 0) {
+            *it = move(merged);
+        } else {
+            current_segments.erase(it);
+        }
+        Publish(draft);
+    }
+}
+
+void SearchServer::RemoveIndexedDocument(int document_id, const vector<TermId>& term_ids) {
+    if (log_ != nullptr) {
+        log_->AppendRemoveDocument(++log_sequence_number_, document_id);
+    }
+    IndexDraft draft = BeginWrite();
+    const auto [segment, ordinal] = draft.snapshot.FindDocument(document_id);
+    if (segment == draft.mutable_segment.get()) {
+        draft.mutable_segment->RemoveDocument(ordinal, term_ids);
+        draft.removed_term_ids = term_ids;
+    } else {
+        // Postings of sealed segments are dropped by the background purge
+        auto tombstones = make_shared<Tombstones>(*draft.snapshot.tombstones);
+        tombstones->Add(ordinal);
+        draft.snapshot.tombstones = move(tombstones);
+        tombstone_term_ids_.emplace(ordinal, term_ids);
+        RequestPurge();
+    }
+    --draft.snapshot.document_count;
+    for (TermId term_id : term_ids) {
+        draft.snapshot.term_statistics.AddDocuments(term_id, -1);
+    }
+    {
+        lock_guard word_freqs_guard(word_freqs_mutex_);
+        id_to_word_freqs_.erase(document_id);
+        document_ids_.erase(document_id);
+    }
+    Publish(draft);
+    // Views returned by GetWordFrequencies change here only, not in the background thread
+    CompactTermsIfNeeded();
+}
+
+void SearchServer::EraseTombstones(IndexDraft& draft, const IndexSegment& segment) {
+    const Tombstones& tombstones = *draft.snapshot.tombstones;
+    if (!tombstones.ContainsAny(segment.GetFirstOrdinal(), segment.GetOrdinalEnd())) {
+        return;
+    }
+    auto erased_tombstones = make_shared<Tombstones>(tombstones);
+    tombstones.ForEach(segment.GetFirstOrdinal(), segment.GetOrdinalEnd(), [&](int ordinal) {
+        erased_tombstones->Erase(ordinal);
+        const vector<TermId> term_ids = move(tombstone_term_ids_.extract(ordinal).mapped());
+        draft.removed_term_ids.insert(draft.removed_term_ids.end(), term_ids.begin(),
+                                      term_ids.end());
+    });
+    draft.snapshot.tombstones = move(erased_tombstones);
+}
+
+void SearchServer::PurgeRemovedDocuments() {
+    // Removed documents of every segment with their terms
+    vector<pair<shared_ptr<const SealedSegment>, vector<pair<int, vector<TermId>>>>> purges;
+    {
+        lock_guard guard(write_mutex_);
+        const auto snapshot = GetSnapshot();
+        const Tombstones& tombstones = *snapshot->tombstones;
+        for (const auto& segment : snapshot->sealed_segments) {
+            vector<pair<int, vector<TermId>>> removed_documents;
+            tombstones.ForEach(segment->GetFirstOrdinal(), segment->GetOrdinalEnd(),
+                               [this, &removed_documents](int ordinal) {
+                                   removed_documents.push_back(
+                                       {ordinal, tombstone_term_ids_.at(ordinal)});
+                               });
+            if (!removed_documents.empty()) {
+                purges.push_back({segment, move(removed_documents)});
+            }
+        }
+    }
+    if (purges.empty()) {
+        return;
+    }
+    // Only posting lists of the removed terms are rebuilt, without the writer lock
+    vector<shared_ptr<const SealedSegment>> purged_segments;
+    for (const auto& [segment, removed_documents] : purges) {
+        purged_segments.push_back(make_shared<const SealedSegment>(segment, removed_documents));
+    }
+
+    lock_guard guard(write_mutex_);
+    IndexDraft draft = BeginWrite();
+    auto& sealed_segments = draft.snapshot.sealed_segments;
+    auto tombstones = make_shared<Tombstones>(*draft.snapshot.tombstones);
+    for (size_t i = 0; i < purges.size(); ++i) {
+        const auto& [segment, removed_documents] = purges[i];
+        auto it = find(sealed_segments.begin(), sealed_segments.end(), segment);
+        // The segment was merged or purged since, its removed documents are gone already
+        if (it == sealed_segments.end()) {
+            continue;
+        }
+        // Documents removed meanwhile keep their ordinals and tombstones
+        for (const auto& [ordinal, term_ids] : removed_documents) {
+            tombstones->Erase(ordinal);
+            tombstone_term_ids_.erase(ordinal);
+            draft.removed_term_ids.insert(draft.removed_term_ids.end(), term_ids.begin(),
+                                          term_ids.end());
+        }
+        if (purged_segments[i]->GetLiveDocumentCount() > 0) {
+            *it = move(purged_segments[i]);
+        } else {
+            sealed_segments.erase(it);
+        }
+    }
+    draft.snapshot.tombstones = move(tombstones);
+    Publish(draft);
+}
+
+void SearchServer::RequestMerge() {
+    lock_guard guard(background_mutex_);
+    is_merge_requested_ = true;
+    StartBackgroundThread();
+    background_work_requested_.notify_one();
+}
+
+void SearchServer::RequestPurge() {
+    lock_guard guard(background_mutex_);
+    is_purge_requested_ = true;
+    StartBackgroundThread();
+    background_work_requested_.notify_one();
+}
+
+void SearchServer::StartBackgroundThread() {
+    if (background_thread_.joinable()) {
+        return;
+    }
+    background_thread_ = thread([this] {
+        unique_lock lock(background_mutex_);
+        while (true) {
+            background_work_requested_.wait(lock, [this] {
+                return is_merge_requested_ || is_purge_requested_ || is_background_stopped_;
+            });
+            if (is_background_stopped_) {
+                return;
+            }
+            const bool is_merge_requested = exchange(is_merge_requested_, false);
+            const bool is_purge_requested = exchange(is_purge_requested_, false);
+            lock.unlock();
+            // Merges drop removed documents of their sources, so they go first
+            if (is_merge_requested) {
+                MergeSegments();
+            }
+            if (is_purge_requested) {
+                PurgeRemovedDocuments();
+            }
+            lock.lock();
+        }
+    });
+}
+
+void SearchServer::ReleaseUnusedTerms(const IndexSnapshot& snapshot,
+                                      const vector<TermId>& term_ids) {
+    lock_guard terms_guard(terms_mutex_);
+    for (TermId term_id : term_ids) {
+        if (!snapshot.HasPostings(term_id)) {
+            terms_.Release(term_id);
+        }
+    }
+}
+
+void SearchServer::CompactTermsIfNeeded() {
+    const size_t released_bytes = terms_.GetReleasedBytes();
+    if (released_bytes < TextArena::CHUNK_SIZE || released_bytes * 2 < terms_.GetStoredBytes()) {
+        return;
+    }
+    // The previous storage is alive until the forward index is moved to the new views
+    unique_lock terms_guard(terms_mutex_);
+    const TextArena previous_storage = terms_.Compact();
+    terms_guard.unlock();
+    lock_guard word_freqs_guard(word_freqs_mutex_);
+    for (auto& [document_id, word_freqs] : id_to_word_freqs_) {
+        map<string_view, double> compacted_word_freqs;
+        for (const auto [word, freq] : word_freqs) {
+            compacted_word_freqs.emplace_hint(compacted_word_freqs.end(),
+                                              terms_.GetTerm(terms_.Find(word)), freq);
+        }
+        word_freqs = move(compacted_word_freqs);
+    }
+}
+
+bool SearchServer::ContainsTerm(const IndexSegment& segment, TermId term_id, int ordinal) {
+    if (term_id == INVALID_TERM_ID) {
+        return false;
+    }
+    // The document goes the way of a MatchDocuments batch of one
+    thread_local vector<uint32_t> indexes;
+    indexes.assign(1, 0);
+    FilterIndexes(segment.GetPostings(term_id), ordinal, true, indexes);
+    return !indexes.empty();
+}
+
+SearchServer::RelevanceThreshold::RelevanceThreshold(size_t count)
+    : count_(count) {
+}
+
+double SearchServer::RelevanceThreshold::Get() const {
+    if (best_.size() < count_) {
+        return -numeric_limits<double>::infinity();
+    }
+    return best_.top() - EPSILON;
+}
+
+void SearchServer::RelevanceThreshold::Add(double relevance) {
+    if (best_.size() < count_) {
+        best_.push(relevance);
+    } else if (best_.top() < relevance) {
+        best_.pop();
+        best_.push(relevance);
+    }
+}
+
+vector<Document> SearchServer::SelectTopDocuments(vector<Document> documents,
+                                                  const SearchOptions& options) {
+    if (options.offset >= documents.size()) {
+        return {};
+    }
+    const size_t end = options.offset + min(options.count, documents.size() - options.offset);
+    const auto is_more_relevant = [](const Document& lhs, const Document& rhs) {
+        if (abs(lhs.relevance - rhs.relevance) < EPSILON) {
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.relevance > rhs.relevance;
+    };
+    // partial_sort keeps a heap of the end best documents, so a page of a broad query
+    // costs O(n log k) instead of a sort of every match
+    if (end < documents.size()) {
+        partial_sort(documents.begin(), documents.begin() + end, documents.end(),
+                     is_more_relevant);
+        documents.resize(end);
+    } else {
+        sort(documents.begin(), documents.end(), is_more_relevant);
+    }
+    documents.erase(documents.begin(), documents.begin() + options.offset);
+    return documents;
+}
+
+void SearchServer::SubtractPostings(const IndexSegment& segment, const vector<TermId>& terms,
+                                    int ordinal_base, vector<uint32_t>& indexes) {
+    for (TermId term_id : terms) {
+        if (term_id != INVALID_TERM_ID) {
+            FilterIndexes(segment.GetPostings(term_id), ordinal_base, false, indexes);
+        }
+    }
+}
+
+void SearchServer::FilterIndexes(PostingListView postings, int ordinal_base, bool is_found,
+                                 vector<uint32_t>& indexes) {
+    if (indexes.empty()) {
+        return;
+    }
+    PostingCursor cursor(postings);
+    if (indexes.size() * POSTING_GALLOP_RATIO < postings.size()) {
+        size_t kept_count = 0;
+        for (uint32_t index : indexes) {
+            const int ordinal = ordinal_base + static_cast<int>(index);
+            cursor.Advance(ordinal);
+            if ((cursor.GetDocumentId() == ordinal) == is_found) {
+                indexes[kept_count++] = index;
+            }
+        }
+        indexes.resize(kept_count);
+        return;
+    }
+    // Postings within the range of the indexes are decoded and merged at once
+    thread_local vector<uint32_t> posting_indexes;
+    const int last_ordinal = ordinal_base + static_cast<int>(indexes.back());
+    posting_indexes.clear();
+    for (cursor.Advance(ordinal_base + static_cast<int>(indexes.front()));
+         !cursor.IsEnd() && cursor.GetDocumentId() <= last_ordinal; cursor.Next()) {
+        posting_indexes.push_back(static_cast<uint32_t>(cursor.GetDocumentId() - ordinal_base));
+    }
+    indexes.resize(is_found ? IntersectIds(indexes, posting_indexes, indexes.data())
+                            : SubtractIds(indexes, posting_indexes, indexes.data()));
 }
 
 void AddDocument(SearchServer& search_server, int document_id, const string& document,
@@ -297,12 +1357,11 @@ void FindTopDocuments(const SearchServer& search_server, const string& raw_query
 void MatchDocuments(const SearchServer& search_server, const string& query) {
     try {
         cout << "Matching for request: "s << query << endl;
-        const int document_count = search_server.GetDocumentCount();
-        auto document_id_it = search_server.begin();
-        for (int index = 0; index < document_count; ++index) {
-            const int document_id = *document_id_it++;
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
+        const vector<int> document_ids(search_server.begin(), search_server.end());
+        const auto results = search_server.MatchDocuments(query, document_ids);
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto& [words, status] = results[i];
+            PrintMatchDocumentResult(document_ids[i], words, status);
         }
     } catch (const exception& e) {
         cout << "Error in matchig request "s << query << ": "s << e.what() << endl;
@@ -1,23 +1,100 @@
 #pragma once
 #include <algorithm>
 #include <cmath>
-#include <deque>
+#include <condition_variable>
 #include <execution>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <queue>
+#include <shared_mutex>
 #include <stdexcept>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 
-#include "concurrent_map.h"
+#include "cancellation.h"
 #include "document.h"
+#include "id_kernels.h"
+#include "index_file.h"
+#include "index_snapshot.h"
+#include "query_budget.h"
+#include "relevance_accumulator.h"
+#include "result_cache.h"
 #include "string_processing.h"
+#include "term_dictionary.h"
+#include "thread_pool.h"
+#include "write_ahead_log.h"
 
 using namespace std::string_literals;
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double EPSILON = 1e-6;
-const int CONCURRENT_MAP_BUCKETS_AMOUNT = 32;
+// Parallel queries score ranges of this many ordinals of a segment independently
+const int QUERY_PARTITION_DOCUMENT_COUNT = 1 << 16;
+// Batches of queries go through smaller partitions, so the postings decoded for all
+// queries of the batch stay in cache while every query reads them
+const int BATCH_PARTITION_DOCUMENT_COUNT = 1 << 12;
+// Documents are looked up in a posting list one by one, skipping whole blocks, when the
+// list is this many times longer than the list of documents
+const size_t POSTING_GALLOP_RATIO = 16;
+const size_t RESULT_CACHE_SHARD_COUNT = 16;
+const int MUTABLE_SEGMENT_DOCUMENT_COUNT = 1024;
 
+enum class QueryMode {
+    // Scores every document containing a plus word
+    EXHAUSTIVE,
+    // Skips documents and posting blocks whose maximum possible relevance can not get
+    // them into the page (Block-Max WAND). Returns the same documents as EXHAUSTIVE.
+    BLOCK_MAX_WAND,
+};
+
+// Page of the results returned by FindTopDocuments
+struct SearchOptions {
+    size_t count = MAX_RESULT_DOCUMENT_COUNT;
+    // Number of the best documents skipped before the page
+    size_t offset = 0;
+    QueryMode mode = QueryMode::EXHAUSTIVE;
+    // Unlimited by default
+    QueryBudget budget{};
+};
+
+// Results of SearchServer::Search
+struct SearchResult {
+    std::vector<Document> documents;
+    // The budget of the query ran out before all of its postings were scanned
+    bool is_partial = false;
+};
+
+// Query parsed once by SearchServer::PrepareQuery, with its words resolved against the
+// current version of the index. After the index changes, the words are resolved again
+// on every call, which skips parsing still. Copies share the text of the query, so the
+// matched words returned for it stay valid while any copy lives.
+class PreparedQuery {
+public:
+    PreparedQuery() = default;
+
+private:
+    friend class SearchServer;
+
+    std::shared_ptr<const std::string> text_;
+    // Deduplicated and sorted, point into the text
+    std::vector<std::string_view> plus_words_;
+    std::vector<std::string_view> minus_words_;
+    // Aligned with the words, valid in the snapshot with the epoch
+    uint64_t epoch_ = 0;
+    std::vector<TermId> plus_terms_;
+    std::vector<TermId> minus_terms_;
+};
+
+// Queries run on a snapshot of the index and do not block or get blocked by writers.
+// Writers (AddDocument, AddDocuments, RemoveDocument) are serialized with each other.
+// begin(), end() and GetWordFrequencies are not synchronized with writers.
 class SearchServer {
 public:
     template <typename StringContainer>
@@ -27,38 +104,144 @@ public:
 
     explicit SearchServer(std::string_view stop_words_text);
 
+    ~SearchServer();
+
+    // Opens an index written by Save. Index arrays are used in place from the mapped
+    // file, so pages are loaded on demand and shared between processes.
+    // Throws std::runtime_error if the file can not be opened or has an unknown format.
+    static SearchServer Open(const std::string& path);
+
+    // Writes the index in the binary format, replacing the file atomically.
+    // Records of the write-ahead log are dropped once the index is written, so recovery
+    // has to open the index written by the last Save.
+    void Save(const std::string& path) const;
+
+    // Replays mutations from the log which are newer than the index, then appends every
+    // following mutation to it. Mutations are synced to disk in batches, so a crash loses
+    // at most the last options.flush_interval of them unless SyncLog is called.
+    // Recovery after a crash is Open of the last saved index (or construction of an empty
+    // server) followed by OpenLog. Must not be called concurrently with other writers.
+    void OpenLog(const std::string& path, WriteAheadLogOptions options = {});
+
+    // Waits until all mutations made so far are durable in the log
+    void SyncLog();
+
     void AddDocument(int document_id, std::string_view document, DocumentStatus status,
                      const std::vector<int>& ratings);
 
+    // Adds a range of DocumentInput. Documents are tokenized according to the policy,
+    // then merged into the index in one pass. Nothing is added if any document is invalid.
+    template <typename ExecutionPolicy, typename DocumentRange>
+    void AddDocuments(const ExecutionPolicy& policy, const DocumentRange& documents);
+
+    template <typename DocumentRange>
+    void AddDocuments(const DocumentRange& documents);
+
     std::set<int>::const_iterator begin() const;
 
     std::set<int>::const_iterator end() const;
 
+    // Documents are ordered by relevance, documents with equal relevance by rating
     template <typename ExecutionPolicy, typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
                                            std::string_view raw_query,
-                                           DocumentPredicate document_predicate) const;
+                                           DocumentPredicate document_predicate,
+                                           const SearchOptions& options = {}) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::string_view raw_query,
-                                           DocumentPredicate document_predicate) const;
+                                           DocumentPredicate document_predicate,
+                                           const SearchOptions& options = {}) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                           std::string_view raw_query,
+                                           DocumentStatus status,
+                                           const SearchOptions& options = {}) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query,
+                                           DocumentStatus status,
+                                           const SearchOptions& options = {}) const;
 
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
                                            std::string_view raw_query,
-                                           DocumentStatus status) const;
+                                           const SearchOptions& options = {}) const;
 
     std::vector<Document> FindTopDocuments(std::string_view raw_query,
-                                           DocumentStatus status) const;
+                                           const SearchOptions& options = {}) const;
+
+    PreparedQuery PrepareQuery(std::string_view raw_query) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                           const PreparedQuery& query,
+                                           DocumentPredicate document_predicate,
+                                           const SearchOptions& options = {}) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query,
+                                           DocumentPredicate document_predicate,
+                                           const SearchOptions& options = {}) const;
 
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
-                                           std::string_view raw_query) const;
+                                           const PreparedQuery& query,
+                                           DocumentStatus status,
+                                           const SearchOptions& options = {}) const;
 
-    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query,
+                                           DocumentStatus status,
+                                           const SearchOptions& options = {}) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                           const PreparedQuery& query,
+                                           const SearchOptions& options = {}) const;
+
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query,
+                                           const SearchOptions& options = {}) const;
+
+    // FindTopDocuments which also tells whether the budget of the query ran out, so the
+    // documents are the best ones among the postings scanned until then
+    SearchResult Search(std::string_view raw_query,
+                        DocumentStatus status = DocumentStatus::ACTUAL,
+                        const SearchOptions& options = {}) const;
+
+    SearchResult Search(const PreparedQuery& query,
+                        DocumentStatus status = DocumentStatus::ACTUAL,
+                        const SearchOptions& options = {}) const;
+
+    // Number of queries which ran out of their budget
+    uint64_t GetPartialQueryCount() const;
+
+    // Runs a batch of queries with the ACTUAL status like FindTopDocuments, decoding the
+    // postings of every word once for the whole batch. Words are scanned in sorted order,
+    // the order in which every query sums them up, so the results are equal to the ones
+    // of FindTopDocuments. Only batches whose queries share most of their words gain from
+    // it, so ProcessQueries does not use it.
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(
+        const std::vector<std::string>& raw_queries) const;
+
+    // Runs FindTopDocuments on the thread pool of the server. The token becomes the
+    // cancellation of the query budget: a query cancelled before a worker takes it is
+    // skipped, a running one stops at the next budget check, and its future throws
+    // QueryCancelledError. Errors of the query are thrown by the future as well.
+    // A query whose budget runs out otherwise returns the documents found so far with
+    // is_partial set. The destructor of the server waits for the queries started here.
+    std::future<SearchResult> FindTopDocumentsAsync(
+        std::string raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+        const SearchOptions& options = {}, CancellationToken token = {}) const;
+
+    std::future<SearchResult> FindTopDocumentsAsync(
+        PreparedQuery query, DocumentStatus status = DocumentStatus::ACTUAL,
+        const SearchOptions& options = {}, CancellationToken token = {}) const;
 
     int GetDocumentCount() const;
 
+    // Returned maps stay valid until the next RemoveDocument call, which erases the map of
+    // the document and may move the term views of all maps to a compacted storage.
+    // Frequencies of documents from an index file are loaded on the first call.
     const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
     std::tuple<std::vector<std::string_view>, DocumentStatus>
@@ -76,32 +259,157 @@ public:
         int document_id
     ) const;
 
+    std::tuple<std::vector<std::string_view>, DocumentStatus>
+    MatchDocument(const PreparedQuery& query, int document_id) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::sequenced_policy&,
+        const PreparedQuery& query,
+        int document_id
+    ) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::parallel_policy& policy,
+        const PreparedQuery& query,
+        int document_id
+    ) const;
+
+    // Matches the query against many documents, parsing and resolving it once. Postings
+    // of every word are merged with the documents in index order. Results follow the
+    // order of the ids.
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        std::string_view raw_query,
+        const std::vector<int>& document_ids
+    ) const;
+
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        const std::execution::sequenced_policy&,
+        std::string_view raw_query,
+        const std::vector<int>& document_ids
+    ) const;
+
+    // Words of the query are matched in parallel
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        const std::execution::parallel_policy& policy,
+        std::string_view raw_query,
+        const std::vector<int>& document_ids
+    ) const;
+
     void RemoveDocument(int document_id);
 
     void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
 
     void RemoveDocument(const std::execution::parallel_policy& policy, int document_id);
 
+    // Removal from a sealed segment only marks the document as removed. Its postings are
+    // dropped by a background thread which calls this method, it can also be called
+    // directly to purge synchronously.
+    void PurgeRemovedDocuments();
+
+    // New documents are collected in a mutable segment which is sealed into a packed
+    // immutable one once it has document_count documents. Sealed segments are merged in
+    // the background.
+    void SetMutableSegmentSize(int document_count);
+
+    // Results of FindTopDocuments filtered by status, ACTUAL by default, are cached for up
+    // to entry_count queries. Zero turns the cache off. Statistics start anew.
+    void SetResultCacheCapacity(size_t entry_count);
+
+    // Zeros while the cache is off
+    ResultCacheStats GetResultCacheStats() const;
+
+    // Workers of parallel queries and ProcessQueries. Queries which already run keep the
+    // previous pool until they finish.
+    void SetThreadPoolOptions(ThreadPoolOptions options);
+
+    // Created with default options on the first use
+    std::shared_ptr<ThreadPool> GetThreadPool() const;
+
 private:
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
-    };
     const std::set<std::string, std::less<>> stop_words_;
-    std::deque<std::string> document_to_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> id_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
+    // Readers resolve words and take the snapshot under a shared lock, so term ids
+    // always match the snapshot. Writers change the dictionary under an exclusive lock.
+    mutable std::shared_mutex terms_mutex_;
+    TermDictionary terms_;
+    // Documents are numbered with dense ordinals in the order of addition and live in
+    // segments with growing ordinal ranges. Writers publish a new snapshot after every
+    // change, the published one is accessed with atomic shared_ptr operations.
+    std::shared_ptr<const IndexSnapshot> snapshot_ = MakeEmptySnapshot();
+    // Replaced atomically, so it is set up without stopping queries
+    std::shared_ptr<ResultCache> result_cache_;
+    mutable std::mutex thread_pool_mutex_;
+    mutable std::shared_ptr<ThreadPool> thread_pool_;
+    // Number of queries started by FindTopDocumentsAsync which have not finished
+    mutable std::mutex async_query_mutex_;
+    mutable std::condition_variable async_queries_finished_;
+    mutable size_t async_query_count_ = 0;
+    mutable std::atomic<uint64_t> partial_query_count_{0};
+
+    // Fields below are used by writers only
+    mutable std::mutex write_mutex_;
+    int mutable_segment_size_ = MUTABLE_SEGMENT_DOCUMENT_COUNT;
+    // Guards id_to_word_freqs_ and document_ids_, GetWordFrequencies fills the map lazily
+    mutable std::mutex word_freqs_mutex_;
+    mutable std::map<int, std::map<std::string_view, double>> id_to_word_freqs_;
     std::set<int> document_ids_;
+    // Terms of the documents in the tombstones by ordinal, their postings are dropped by purge
+    std::unordered_map<int, std::vector<TermId>> tombstone_term_ids_;
+    // File the index was opened from, documents missing in id_to_word_freqs_ are in it
+    std::shared_ptr<const IndexFile> index_file_;
+    std::unique_ptr<WriteAheadLog> log_;
+    // Number of the last logged or replayed mutation
+    uint64_t log_sequence_number_ = 0;
+
+    explicit SearchServer(std::shared_ptr<const IndexFile> index_file);
+
+    static std::set<std::string, std::less<>> LoadStopWords(const IndexFile& index_file);
+
+    std::map<std::string_view, double> LoadWordFrequencies(int document_id) const;
+
+    // Background thread merging sealed segments and purging removed documents
+    std::mutex background_mutex_;
+    std::condition_variable background_work_requested_;
+    bool is_merge_requested_ = false;
+    bool is_purge_requested_ = false;
+    bool is_background_stopped_ = false;
+    std::thread background_thread_;
+
+    // Copy of the published snapshot being changed by a writer
+    struct IndexDraft {
+        IndexSnapshot snapshot;
+        // Writable copy of the mutable segment of the snapshot
+        std::shared_ptr<MutableSegment> mutable_segment;
+        // Terms whose postings were dropped, released on publishing if no longer used
+        std::vector<TermId> removed_term_ids;
+    };
+
+    static std::shared_ptr<const IndexSnapshot> MakeEmptySnapshot();
+
+    std::shared_ptr<const IndexSnapshot> GetSnapshot() const;
+
+    IndexDraft BeginWrite() const;
+
+    void Publish(IndexDraft& draft);
 
     bool IsStopWord(std::string_view word) const;
 
     static bool IsValidWord(std::string_view word);
 
-    std::vector<std::string_view> SplitIntoWordsNoStop(const std::string& text) const;
+    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
+    struct TokenizedDocument {
+        // Distinct words sorted lexicographically with the number of occurrences
+        std::vector<std::pair<std::string_view, uint32_t>> word_counts;
+        double inv_word_count;
+    };
+
+    TokenizedDocument TokenizeDocument(std::string_view text) const;
+
+    void IndexDocument(IndexDraft& draft, int document_id, const TokenizedDocument& document,
+                       DocumentStatus status, int rating);
+
     struct QueryWord {
         std::string_view data;
         bool is_minus;
@@ -119,18 +427,175 @@ private:
 
     Query ParseQueryPar(std::string_view text) const;
 
-    // Existence required
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    // Query words resolved against a snapshot of the index
+    struct ResolvedQuery {
+        std::shared_ptr<const IndexSnapshot> snapshot;
+        // Aligned with the query words, INVALID_TERM_ID for words missing in the index
+        std::vector<TermId> plus_terms;
+        std::vector<TermId> minus_terms;
+    };
+
+    ResolvedQuery ResolveQuery(const Query& query) const;
+
+    // Terms of the prepared query if the index has not changed since it was prepared
+    ResolvedQuery ResolveQuery(const PreparedQuery& query) const;
+
+    // Seals the mutable segment, merging is left to the background thread
+    void SealMutableSegment(IndexDraft& draft);
+
+    // Merges sealed segments of similar size until they shrink towards the end. Segments are
+    // merged without the writer lock and replace the sources if they are still published.
+    void MergeSegments();
+
+    // Drops tombstones of the segment which is purged
+    void EraseTombstones(IndexDraft& draft, const IndexSegment& segment);
+
+    void RequestMerge();
+
+    void RequestPurge();
+
+    // Requires background_mutex_
+    void StartBackgroundThread();
+
+    // Removes the document and publishes the new snapshot
+    void RemoveIndexedDocument(int document_id, const std::vector<TermId>& term_ids);
+
+    // Releases terms that are no longer met in any document of the snapshot
+    void ReleaseUnusedTerms(const IndexSnapshot& snapshot, const std::vector<TermId>& term_ids);
+
+    // Compacts the term storage once most of it is taken by released terms
+    void CompactTermsIfNeeded();
+
+    static bool ContainsTerm(const IndexSegment& segment, TermId term_id, int ordinal);
+
+    // Calls func(index) for every index in [0, count). The parallel policy runs the calls
+    // on the thread pool of the server, so callers passing it start no other threads.
+    template <typename ExecutionPolicy, typename Func>
+    void ForEachIndex(const ExecutionPolicy& policy, size_t count, Func func) const;
+
+    template <typename ExecutionPolicy>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const ExecutionPolicy& policy,
+        const std::vector<std::string_view>& plus_words,
+        const ResolvedQuery& query,
+        int document_id
+    ) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+        const ExecutionPolicy& policy,
+        const Query& query,
+        const std::vector<int>& document_ids
+    ) const;
+
+    // Leaves the page of options out of documents, ordering only the documents up to its end
+    static std::vector<Document> SelectTopDocuments(std::vector<Document> documents,
+                                                    const SearchOptions& options);
+
+    // Relevance a document needs to get into the count best documents seen so far.
+    // Documents less relevant than all of those by more than EPSILON can not.
+    class RelevanceThreshold {
+    public:
+        explicit RelevanceThreshold(size_t count);
+
+        double Get() const;
+
+        void Add(double relevance);
+
+    private:
+        size_t count_;
+        std::priority_queue<double, std::vector<double>, std::greater<double>> best_;
+    };
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                           const ResolvedQuery& query,
+                                           DocumentPredicate document_predicate,
+                                           const SearchOptions& options) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    SearchResult Search(const ExecutionPolicy& policy, const ResolvedQuery& query,
+                        DocumentPredicate document_predicate,
+                        const SearchOptions& options) const;
+
+    // Goes through the result cache if it is on. Partial results are not cached.
+    template <typename ExecutionPolicy>
+    SearchResult Search(const ExecutionPolicy& policy,
+                        const std::vector<std::string_view>& plus_words,
+                        const std::vector<std::string_view>& minus_words,
+                        const ResolvedQuery& query,
+                        DocumentStatus status,
+                        const SearchOptions& options) const;
+
+    // Words have to be deduplicated and sorted
+    static std::string MakeResultCacheKey(const std::vector<std::string_view>& plus_words,
+                                          const std::vector<std::string_view>& minus_words,
+                                          DocumentStatus status, const SearchOptions& options);
+
+    // Returns documents which may get into the count most relevant ones, skipping the
+    // rest with Block-Max WAND
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopCandidates(const std::execution::sequenced_policy&,
+                                            const ResolvedQuery& query,
+                                            DocumentPredicate document_predicate,
+                                            size_t count, QueryBudgetTracker& budget) const;
+
+    // Segments are searched in parallel, each with its own threshold
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopCandidates(const std::execution::parallel_policy&,
+                                            const ResolvedQuery& query,
+                                            DocumentPredicate document_predicate,
+                                            size_t count, QueryBudgetTracker& budget) const;
+
+    template <typename DocumentPredicate>
+    static void FindSegmentTopCandidates(const IndexSnapshot& snapshot,
+                                         const IndexSegment& segment,
+                                         const std::vector<TermId>& plus_terms,
+                                         const std::vector<TermId>& minus_terms,
+                                         DocumentPredicate& document_predicate,
+                                         RelevanceThreshold& threshold,
+                                         QueryBudgetTracker& budget,
+                                         std::vector<Document>& candidates);
+
+    // Removes the documents containing any of the terms from ascending indexes, which are
+    // ordinals minus ordinal_base
+    static void SubtractPostings(const IndexSegment& segment, const std::vector<TermId>& terms,
+                                 int ordinal_base, std::vector<uint32_t>& indexes);
 
+    // Keeps the ascending indexes, which are ordinals minus ordinal_base, found in the
+    // postings if is_found is set and the ones missing in the postings otherwise
+    static void FilterIndexes(PostingListView postings, int ordinal_base, bool is_found,
+                              std::vector<uint32_t>& indexes);
+
+    // Range of ordinals of a segment scored by one task
+    struct QueryPartition {
+        const IndexSegment* segment;
+        int ordinal_begin;
+        int ordinal_end;
+    };
+
+    std::future<SearchResult> RunQueryAsync(std::function<SearchResult()> query,
+                                            CancellationToken token) const;
+
+    void FinishAsyncQuery() const;
+
+    static std::vector<QueryPartition> MakeQueryPartitions(const IndexSnapshot& snapshot,
+                                                           int partition_document_count);
+
+    // Returns the matched documents. Documents which can not get into the count most
+    // relevant ones may be left out.
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy&,
-                                           const Query& query,
-                                           DocumentPredicate document_predicate) const;
+                                           const ResolvedQuery& query,
+                                           DocumentPredicate document_predicate,
+                                           size_t count, QueryBudgetTracker& budget) const;
 
+    // Partitions are scored in parallel, each keeps its count most relevant documents
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(const std::execution::parallel_policy&,
-                                           const Query& query,
-                                           DocumentPredicate document_predicate) const;
+                                           const ResolvedQuery& query,
+                                           DocumentPredicate document_predicate,
+                                           size_t count, QueryBudgetTracker& budget) const;
 };
 
 template <typename StringContainer>
@@ -142,83 +607,435 @@ SearchServer::SearchServer(const StringContainer& stop_words)
     }
 }
 
-template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
-                                                     std::string_view raw_query,
-                                                     DocumentPredicate document_predicate) const {
-    const auto query = ParseQuery(raw_query);
+template <typename ExecutionPolicy, typename DocumentRange>
+void SearchServer::AddDocuments(const ExecutionPolicy& policy, const DocumentRange& documents) {
+    std::vector<const DocumentInput*> inputs;
+    for (const DocumentInput& document : documents) {
+        inputs.push_back(&document);
+    }
+    // Errors are rethrown in the order of the documents, not of the tokenization
+    std::vector<TokenizedDocument> tokenized(inputs.size());
+    std::vector<std::exception_ptr> errors(inputs.size());
+    ForEachIndex(policy, inputs.size(), [this, &inputs, &tokenized, &errors](size_t index) {
+        try {
+            tokenized[index] = TokenizeDocument(inputs[index]->text);
+        } catch (...) {
+            errors[index] = std::current_exception();
+        }
+    });
 
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+    std::lock_guard guard(write_mutex_);
+    std::unordered_set<int> new_ids;
+    for (size_t index = 0; index < inputs.size(); ++index) {
+        const int document_id = inputs[index]->id;
+        if (document_id < 0 || document_ids_.count(document_id) > 0
+            || !new_ids.insert(document_id).second) {
+            throw std::invalid_argument("Invalid document_id"s);
+        }
+        if (errors[index]) {
+            std::rethrow_exception(errors[index]);
+        }
+    }
 
-    sort(matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
-                return lhs.rating > rhs.rating;
-            }
-            return lhs.relevance > rhs.relevance;
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    if (log_ != nullptr) {
+        for (const DocumentInput* input : inputs) {
+            log_->AppendAddDocument(++log_sequence_number_, input->id, input->text,
+                                    input->status, input->ratings);
+        }
     }
-    return matched_documents;
+    IndexDraft draft = BeginWrite();
+    for (size_t index = 0; index < inputs.size(); ++index) {
+        IndexDocument(draft, inputs[index]->id, tokenized[index], inputs[index]->status,
+                      ComputeAverageRating(inputs[index]->ratings));
+    }
+    Publish(draft);
+}
+
+template <typename ExecutionPolicy, typename Func>
+void SearchServer::ForEachIndex(const ExecutionPolicy&, size_t count, Func func) const {
+    if constexpr (std::is_same_v<ExecutionPolicy, std::execution::parallel_policy>) {
+        GetThreadPool()->ParallelFor(count, func);
+    } else {
+        for (size_t index = 0; index < count; ++index) {
+            func(index);
+        }
+    }
+}
+
+template <typename DocumentRange>
+void SearchServer::AddDocuments(const DocumentRange& documents) {
+    AddDocuments(std::execution::seq, documents);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     std::string_view raw_query,
+                                                     DocumentPredicate document_predicate,
+                                                     const SearchOptions& options) const {
+    return FindTopDocuments(policy, ResolveQuery(ParseQuery(raw_query)), document_predicate,
+                            options);
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
-                                                     DocumentPredicate document_predicate) const {
-    return FindTopDocuments(std::execution::seq, raw_query, document_predicate);
+                                                     DocumentPredicate document_predicate,
+                                                     const SearchOptions& options) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, options);
 }
 
 template <typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
                                                      std::string_view raw_query,
-                                                     DocumentStatus status) const {
-    return FindTopDocuments(
-        policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
-        });
+                                                     DocumentStatus status,
+                                                     const SearchOptions& options) const {
+    const Query query = ParseQuery(raw_query);
+    return Search(policy, query.plus_words, query.minus_words, ResolveQuery(query), status,
+                  options).documents;
 }
 
 template <typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
-                                                     std::string_view raw_query) const {
-    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+                                                     std::string_view raw_query,
+                                                     const SearchOptions& options) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL, options);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     const PreparedQuery& query,
+                                                     DocumentPredicate document_predicate,
+                                                     const SearchOptions& options) const {
+    return FindTopDocuments(policy, ResolveQuery(query), document_predicate, options);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&,
-                                                     const Query& query,
-                                                     DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    {
-        for (std::string_view word : query.plus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
-                continue;
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query,
+                                                     DocumentPredicate document_predicate,
+                                                     const SearchOptions& options) const {
+    return FindTopDocuments(std::execution::seq, query, document_predicate, options);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     const PreparedQuery& query,
+                                                     DocumentStatus status,
+                                                     const SearchOptions& options) const {
+    return Search(policy, query.plus_words_, query.minus_words_, ResolveQuery(query), status,
+                  options).documents;
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     const PreparedQuery& query,
+                                                     const SearchOptions& options) const {
+    return FindTopDocuments(policy, query, DocumentStatus::ACTUAL, options);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
+                                                     const ResolvedQuery& query,
+                                                     DocumentPredicate document_predicate,
+                                                     const SearchOptions& options) const {
+    return Search(policy, query, document_predicate, options).documents;
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+SearchResult SearchServer::Search(const ExecutionPolicy& policy, const ResolvedQuery& query,
+                                  DocumentPredicate document_predicate,
+                                  const SearchOptions& options) const {
+    // Number of the best documents up to the end of the page
+    const size_t count = options.count > std::numeric_limits<size_t>::max() - options.offset
+        ? std::numeric_limits<size_t>::max() : options.offset + options.count;
+    if (count == 0) {
+        return {};
+    }
+    QueryBudgetTracker budget(options.budget);
+    auto matched_documents = options.mode == QueryMode::BLOCK_MAX_WAND
+        ? FindTopCandidates(policy, query, document_predicate, count, budget)
+        : FindAllDocuments(policy, query, document_predicate, count, budget);
+
+    SearchResult result;
+    result.documents = SelectTopDocuments(std::move(matched_documents), options);
+    result.is_partial = budget.WasExhausted();
+    if (result.is_partial) {
+        partial_query_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return result;
+}
+
+template <typename ExecutionPolicy>
+SearchResult SearchServer::Search(
+    const ExecutionPolicy& policy,
+    const std::vector<std::string_view>& plus_words,
+    const std::vector<std::string_view>& minus_words,
+    const ResolvedQuery& query,
+    DocumentStatus status,
+    const SearchOptions& options
+) const {
+    const auto document_predicate = [status](int, DocumentStatus document_status, int) {
+        return document_status == status;
+    };
+    const std::shared_ptr<ResultCache> cache = std::atomic_load(&result_cache_);
+    if (cache == nullptr) {
+        return Search(policy, query, document_predicate, options);
+    }
+    const std::string key = MakeResultCacheKey(plus_words, minus_words, status, options);
+    // Results are bound to the snapshot the terms were resolved against
+    const uint64_t epoch = query.snapshot->epoch;
+    if (auto documents = cache->Find(key, epoch)) {
+        return {std::move(*documents), false};
+    }
+    SearchResult result = Search(policy, query, document_predicate, options);
+    if (!result.is_partial) {
+        cache->Insert(key, epoch, result.documents);
+    }
+    return result;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopCandidates(const std::execution::sequenced_policy&,
+                                                      const ResolvedQuery& query,
+                                                      DocumentPredicate document_predicate,
+                                                      size_t count,
+                                                      QueryBudgetTracker& budget) const {
+    const IndexSnapshot& snapshot = *query.snapshot;
+    std::vector<TermId> plus_terms;
+    for (TermId term_id : query.plus_terms) {
+        if (term_id != INVALID_TERM_ID && snapshot.GetTermDocumentCount(term_id) > 0) {
+            plus_terms.push_back(term_id);
+        }
+    }
+    std::vector<TermId> minus_terms;
+    for (TermId term_id : query.minus_terms) {
+        if (term_id != INVALID_TERM_ID) {
+            minus_terms.push_back(term_id);
+        }
+    }
+
+    RelevanceThreshold threshold(count);
+    std::vector<Document> candidates;
+    for (const IndexSegment* segment : snapshot.GetSegments()) {
+        FindSegmentTopCandidates(snapshot, *segment, plus_terms, minus_terms, document_predicate,
+                                 threshold, budget, candidates);
+    }
+    const double min_relevance = threshold.Get();
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                    [min_relevance](const Document& document) {
+                                        return document.relevance < min_relevance;
+                                    }),
+                     candidates.end());
+    return candidates;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopCandidates(const std::execution::parallel_policy&,
+                                                      const ResolvedQuery& query,
+                                                      DocumentPredicate document_predicate,
+                                                      size_t count,
+                                                      QueryBudgetTracker& budget) const {
+    const IndexSnapshot& snapshot = *query.snapshot;
+    const std::vector<const IndexSegment*> segments = snapshot.GetSegments();
+    std::vector<TermId> plus_terms;
+    std::copy_if(query.plus_terms.begin(), query.plus_terms.end(), back_inserter(plus_terms),
+        [&snapshot](TermId term_id) {
+            return term_id != INVALID_TERM_ID && snapshot.GetTermDocumentCount(term_id) > 0;
+        });
+    std::vector<TermId> minus_terms;
+    std::copy_if(query.minus_terms.begin(), query.minus_terms.end(), back_inserter(minus_terms),
+        [](TermId term_id) {
+            return term_id != INVALID_TERM_ID;
+        });
+
+    std::vector<std::vector<Document>> segment_candidates(segments.size());
+    const auto find_segment_candidates = [&](const IndexSegment* segment) {
+        DocumentPredicate segment_predicate = document_predicate;
+        RelevanceThreshold threshold(count);
+        std::vector<Document> candidates;
+        FindSegmentTopCandidates(snapshot, *segment, plus_terms, minus_terms,
+                                 segment_predicate, threshold, budget, candidates);
+        return candidates;
+    };
+    GetThreadPool()->ParallelFor(segments.size(), [&](size_t i) {
+        segment_candidates[i] = find_segment_candidates(segments[i]);
+    });
+    std::vector<Document> candidates;
+    for (const std::vector<Document>& documents : segment_candidates) {
+        candidates.insert(candidates.end(), documents.begin(), documents.end());
+    }
+    return candidates;
+}
+
+template <typename DocumentPredicate>
+void SearchServer::FindSegmentTopCandidates(const IndexSnapshot& snapshot,
+                                            const IndexSegment& segment,
+                                            const std::vector<TermId>& plus_terms,
+                                            const std::vector<TermId>& minus_terms,
+                                            DocumentPredicate& document_predicate,
+                                            RelevanceThreshold& threshold,
+                                            QueryBudgetTracker& budget,
+                                            std::vector<Document>& candidates) {
+    const DocumentColumns documents = segment.GetDocuments();
+    const int first_ordinal = segment.GetFirstOrdinal();
+    // In the order of the query, so relevance is summed up as in FindAllDocuments
+    std::vector<PostingCursor> cursors;
+    std::vector<double> inverse_document_freqs;
+    std::vector<double> max_relevances;
+    for (TermId term_id : plus_terms) {
+        const PostingListView postings = segment.GetPostings(term_id);
+        if (postings.empty()) {
+            continue;
+        }
+        const double inverse_document_freq = snapshot.GetInverseDocumentFreq(term_id);
+        cursors.emplace_back(postings);
+        inverse_document_freqs.push_back(inverse_document_freq);
+        max_relevances.push_back(postings.GetMaxTermFreq() * inverse_document_freq);
+    }
+    std::vector<PostingCursor> minus_cursors;
+    for (TermId term_id : minus_terms) {
+        minus_cursors.emplace_back(segment.GetPostings(term_id));
+    }
+
+    // Indexes of cursors which are not at the end, by current document
+    std::vector<size_t> order(cursors.size());
+    std::iota(order.begin(), order.end(), 0);
+    while (true) {
+        std::sort(order.begin(), order.end(), [&cursors](size_t lhs, size_t rhs) {
+            return cursors[lhs].GetDocumentId() < cursors[rhs].GetDocumentId();
+        });
+        while (!order.empty() && cursors[order.back()].IsEnd()) {
+            order.pop_back();
+        }
+        const double min_relevance = threshold.Get();
+        // Documents before the pivot contain only terms which can not reach the threshold
+        size_t pivot = 0;
+        double max_relevance = 0.0;
+        for (; pivot < order.size(); ++pivot) {
+            max_relevance += max_relevances[order[pivot]];
+            if (max_relevance >= min_relevance) {
+                break;
             }
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id] += term_freq * inverse_document_freq;
-                }
+        }
+        // Checked only while a pivot is left, so a scan done within the budget is complete
+        if (pivot == order.size() || budget.IsExhausted()) {
+            break;
+        }
+        const int pivot_ordinal = cursors[order[pivot]].GetDocumentId();
+        while (pivot + 1 < order.size()
+               && cursors[order[pivot + 1]].GetDocumentId() == pivot_ordinal) {
+            ++pivot;
+        }
+
+        // Bound of documents from the pivot up to the end of the shortest block or the
+        // next cursor
+        double block_max_relevance = 0.0;
+        int next_ordinal = pivot + 1 < order.size()
+            ? cursors[order[pivot + 1]].GetDocumentId() : std::numeric_limits<int>::max();
+        for (size_t i = 0; i <= pivot; ++i) {
+            PostingCursor& cursor = cursors[order[i]];
+            cursor.ShallowAdvance(pivot_ordinal);
+            block_max_relevance += cursor.GetBlockMaxTermFreq() * inverse_document_freqs[order[i]];
+            const int block_last_ordinal = cursor.GetBlockLastDocumentId();
+            if (block_last_ordinal < next_ordinal) {
+                next_ordinal = block_last_ordinal + 1;
             }
         }
-    }
-    {
-        for (std::string_view word : query.minus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
-                continue;
+        if (block_max_relevance < min_relevance) {
+            for (size_t i = 0; i <= pivot; ++i) {
+                cursors[order[i]].Advance(next_ordinal);
+            }
+            continue;
+        }
+        if (cursors[order[0]].GetDocumentId() != pivot_ordinal) {
+            for (size_t i = 0; i < pivot; ++i) {
+                cursors[order[i]].Advance(pivot_ordinal);
+            }
+            continue;
+        }
+
+        const int index = pivot_ordinal - first_ordinal;
+        const bool is_excluded = std::any_of(minus_cursors.begin(), minus_cursors.end(),
+            [pivot_ordinal](PostingCursor& cursor) {
+                cursor.Advance(pivot_ordinal);
+                return cursor.GetDocumentId() == pivot_ordinal;
+            });
+        // Removed documents keep their postings until they are purged
+        if (!is_excluded && !snapshot.tombstones->Contains(pivot_ordinal)
+            && document_predicate(documents.ids[index], documents.statuses[index],
+                                  documents.ratings[index])) {
+            budget.Spend(pivot + 1);
+            double relevance = 0.0;
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                if (cursors[i].GetDocumentId() == pivot_ordinal) {
+                    const double term_freq =
+                        cursors[i].GetTermCount() * documents.inv_word_counts[index];
+                    relevance += term_freq * inverse_document_freqs[i];
+                }
             }
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.erase(document_id);
+            if (relevance >= min_relevance) {
+                threshold.Add(relevance);
+                candidates.push_back({documents.ids[index], relevance, documents.ratings[index]});
             }
         }
+        for (size_t i = 0; i <= pivot; ++i) {
+            cursors[order[i]].Next();
+        }
+    }
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&,
+                                                     const ResolvedQuery& query,
+                                                     DocumentPredicate document_predicate,
+                                                     size_t,
+                                                     QueryBudgetTracker& budget) const {
+    const IndexSnapshot& snapshot = *query.snapshot;
+    std::vector<TermId> plus_terms;
+    std::vector<double> inverse_document_freqs;
+    for (TermId term_id : query.plus_terms) {
+        // Terms met in removed documents only are skipped along with the documents
+        if (term_id != INVALID_TERM_ID && snapshot.GetTermDocumentCount(term_id) > 0) {
+            plus_terms.push_back(term_id);
+            inverse_document_freqs.push_back(snapshot.GetInverseDocumentFreq(term_id));
+        }
     }
+
     std::vector<Document> matched_documents;
-    {
-        for (const auto [document_id, relevance] : document_to_relevance) {
+    RelevanceAccumulator& accumulator = RelevanceAccumulator::GetThreadLocal();
+    // Every document belongs to one segment, so relevance is final within a segment
+    for (const IndexSegment* segment : snapshot.GetSegments()) {
+        const DocumentColumns documents = segment->GetDocuments();
+        const int first_ordinal = segment->GetFirstOrdinal();
+        accumulator.Reset(documents.ids.size());
+        // Documents scored before the budget runs out keep the relevance of the postings
+        // scanned so far
+        for (size_t i = 0; i < plus_terms.size(); ++i) {
+            const double inverse_document_freq = inverse_document_freqs[i];
+            const PostingListView postings = segment->GetPostings(plus_terms[i]);
+            postings.ForEach([&](int ordinal, uint32_t term_count) {
+                const int index = ordinal - first_ordinal;
+                if (document_predicate(documents.ids[index], documents.statuses[index],
+                                       documents.ratings[index])) {
+                    const double term_freq = term_count * documents.inv_word_counts[index];
+                    accumulator.Add(index, term_freq * inverse_document_freq);
+                }
+            }, [&budget](size_t posting_count) {
+                if (budget.IsExhausted()) {
+                    return false;
+                }
+                budget.Spend(posting_count);
+                return true;
+            });
+        }
+        // Removed documents keep their postings until they are purged
+        snapshot.tombstones->ForEach(
+            first_ordinal, segment->GetOrdinalEnd(), [&accumulator, first_ordinal](int ordinal) {
+                accumulator.Exclude(ordinal - first_ordinal);
+            });
+        std::vector<uint32_t>& indexes = accumulator.GetScored();
+        SubtractPostings(*segment, query.minus_terms, first_ordinal, indexes);
+        for (uint32_t index : indexes) {
             matched_documents.push_back(
-                {document_id, relevance, documents_.at(document_id).rating});
+                {documents.ids[index], accumulator.GetRelevance(index), documents.ratings[index]});
         }
     }
     return matched_documents;
@@ -226,42 +1043,94 @@ std::vector<Document> SearchServer::FindAllDocuments(const std::execution::seque
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&,
-                                                     const Query& query,
-                                                     DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(CONCURRENT_MAP_BUCKETS_AMOUNT);
-    std::vector<std::string_view> words_in_documents;
-    std::copy_if(std::execution::par, query.plus_words.begin(), query.plus_words.end(),
-        back_inserter(words_in_documents), [this](std::string_view plus_word) {
-            return word_to_document_freqs_.count(plus_word);
-        });
-    std::for_each(std::execution::par, words_in_documents.begin(), words_in_documents.end(),
-        [this, &document_to_relevance, document_predicate](std::string_view word) {
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id].ref_to_value += (
-                        term_freq * inverse_document_freq);
+                                                     const ResolvedQuery& query,
+                                                     DocumentPredicate document_predicate,
+                                                     size_t count,
+                                                     QueryBudgetTracker& budget) const {
+    const IndexSnapshot& snapshot = *query.snapshot;
+    std::vector<TermId> plus_terms;
+    std::vector<double> inverse_document_freqs;
+    for (TermId term_id : query.plus_terms) {
+        if (term_id != INVALID_TERM_ID && snapshot.GetTermDocumentCount(term_id) > 0) {
+            plus_terms.push_back(term_id);
+            inverse_document_freqs.push_back(snapshot.GetInverseDocumentFreq(term_id));
+        }
+    }
+
+    const std::vector<QueryPartition> partitions =
+        MakeQueryPartitions(snapshot, QUERY_PARTITION_DOCUMENT_COUNT);
+
+    // Every partition has its own accumulator, so scoring takes no locks
+    std::vector<std::vector<Document>> partition_documents(partitions.size());
+    const auto find_partition_documents = [&, document_predicate](
+                                              const QueryPartition& partition) {
+        const DocumentColumns documents = partition.segment->GetDocuments();
+        const int first_ordinal = partition.segment->GetFirstOrdinal();
+        // The budget is checked before every POSTING_BLOCK_SIZE postings
+        const auto for_each_posting = [&partition, &budget](PostingListView postings,
+                                                            auto func) {
+            size_t posting_count = 0;
+            PostingCursor cursor(postings);
+            for (cursor.Advance(partition.ordinal_begin);
+                 cursor.GetDocumentId() < partition.ordinal_end; cursor.Next()) {
+                if (posting_count == POSTING_BLOCK_SIZE) {
+                    budget.Spend(posting_count);
+                    posting_count = 0;
                 }
-            }
-        });
-    std::for_each(std::execution::par, query.minus_words.begin(), query.minus_words.end(),
-        [this, &document_to_relevance](std::string_view word) {
-            if (word_to_document_freqs_.count(word) != 0) {
-                for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                    document_to_relevance.Erase(document_id);
+                if (posting_count == 0 && budget.IsExhausted()) {
+                    return;
                 }
+                func(cursor.GetDocumentId(), cursor.GetTermCount());
+                ++posting_count;
             }
-        });
-        
-    std::map<int, double> document_to_relevance_map;
-    document_to_relevance_map = document_to_relevance.BuildOrdinaryMap();
+            budget.Spend(posting_count);
+        };
+        RelevanceAccumulator& accumulator = RelevanceAccumulator::GetThreadLocal();
+        accumulator.Reset(partition.ordinal_end - partition.ordinal_begin);
+        for (size_t i = 0; i < plus_terms.size(); ++i) {
+            const double inverse_document_freq = inverse_document_freqs[i];
+            for_each_posting(partition.segment->GetPostings(plus_terms[i]),
+                [&](int ordinal, uint32_t term_count) {
+                    const int index = ordinal - first_ordinal;
+                    if (document_predicate(documents.ids[index], documents.statuses[index],
+                                           documents.ratings[index])) {
+                        const double term_freq =
+                            term_count * documents.inv_word_counts[index];
+                        accumulator.Add(ordinal - partition.ordinal_begin,
+                                        term_freq * inverse_document_freq);
+                    }
+                });
+        }
+        snapshot.tombstones->ForEach(
+            partition.ordinal_begin, partition.ordinal_end, [&](int ordinal) {
+                accumulator.Exclude(ordinal - partition.ordinal_begin);
+            });
+        std::vector<uint32_t>& offsets = accumulator.GetScored();
+        SubtractPostings(*partition.segment, query.minus_terms, partition.ordinal_begin,
+                         offsets);
+        std::vector<Document> matched_documents;
+        for (uint32_t offset : offsets) {
+            const int index = partition.ordinal_begin + static_cast<int>(offset)
+                              - first_ordinal;
+            matched_documents.push_back(
+                {documents.ids[index], accumulator.GetRelevance(offset),
+                 documents.ratings[index]});
+        }
+        if (matched_documents.size() > count) {
+            SearchOptions top;
+            top.count = count;
+            matched_documents = SelectTopDocuments(std::move(matched_documents), top);
+        }
+        return matched_documents;
+    };
+    GetThreadPool()->ParallelFor(partitions.size(), [&](size_t i) {
+        partition_documents[i] = find_partition_documents(partitions[i]);
+    });
+
     std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance_map) {
-        matched_documents.push_back(
-            {document_id, relevance, documents_.at(document_id).rating});
+    for (const std::vector<Document>& documents : partition_documents) {
+        matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
     }
-
     return matched_documents;
 }
 
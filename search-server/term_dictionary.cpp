@@ -0,0 +1,94 @@
+#include "term_dictionary.h"
+
+using namespace std;
+
+TermDictionary::TermDictionary(const vector<string_view>& terms)
+    : id_to_term_(terms)
+    , is_released_(terms.size()) {
+    term_to_id_.reserve(terms.size());
+    for (TermId term_id = 0; term_id < terms.size(); ++term_id) {
+        if (terms[term_id].empty()) {
+            is_released_[term_id] = true;
+            released_ids_.push_back(term_id);
+        } else {
+            term_to_id_.emplace(terms[term_id], term_id);
+            external_bytes_ += terms[term_id].size();
+        }
+    }
+}
+
+TermId TermDictionary::Intern(string_view word) {
+    auto it = term_to_id_.find(word);
+    if (it != term_to_id_.end()) {
+        return it->second;
+    }
+    const string_view term = arena_.Store(word);
+    TermId term_id;
+    if (released_ids_.empty()) {
+        term_id = static_cast<TermId>(id_to_term_.size());
+        id_to_term_.push_back(term);
+        is_released_.push_back(false);
+    } else {
+        term_id = released_ids_.back();
+        released_ids_.pop_back();
+        id_to_term_[term_id] = term;
+        is_released_[term_id] = false;
+    }
+    term_to_id_.emplace(term, term_id);
+    return term_id;
+}
+
+TermId TermDictionary::Find(string_view word) const {
+    auto it = term_to_id_.find(word);
+    if (it == term_to_id_.end()) {
+        return INVALID_TERM_ID;
+    }
+    return it->second;
+}
+
+string_view TermDictionary::GetTerm(TermId term_id) const {
+    return id_to_term_[term_id];
+}
+
+size_t TermDictionary::GetTermCount() const {
+    return id_to_term_.size();
+}
+
+void TermDictionary::Release(TermId term_id) {
+    if (is_released_[term_id]) {
+        return;
+    }
+    term_to_id_.erase(id_to_term_[term_id]);
+    released_bytes_ += id_to_term_[term_id].size();
+    id_to_term_[term_id] = {};
+    is_released_[term_id] = true;
+    released_ids_.push_back(term_id);
+}
+
+size_t TermDictionary::GetStoredBytes() const {
+    return arena_.GetStoredBytes() + external_bytes_;
+}
+
+size_t TermDictionary::GetReleasedBytes() const {
+    return released_bytes_;
+}
+
+TextArena TermDictionary::Compact() {
+    TextArena arena;
+    for (auto& [term, term_id] : term_to_id_) {
+        id_to_term_[term_id] = arena.Store(term);
+    }
+    // Keys of the hash table are views too, so the table is rebuilt over the new storage
+    unordered_map<string_view, TermId> term_to_id;
+    term_to_id.reserve(term_to_id_.size());
+    for (TermId term_id = 0; term_id < id_to_term_.size(); ++term_id) {
+        if (!is_released_[term_id]) {
+            term_to_id.emplace(id_to_term_[term_id], term_id);
+        }
+    }
+    term_to_id_ = move(term_to_id);
+    swap(arena, arena_);
+    released_bytes_ = 0;
+    external_bytes_ = 0;
+    return arena;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "text_arena.h"
+
+using TermId = uint32_t;
+
+const TermId INVALID_TERM_ID = std::numeric_limits<TermId>::max();
+
+class TermDictionary {
+public:
+    TermDictionary() = default;
+
+    // Dictionary with term ids equal to indexes of the terms, empty terms stand for
+    // released ids. Texts are not copied and have to outlive the dictionary.
+    explicit TermDictionary(const std::vector<std::string_view>& terms);
+
+    // Returns id of the word, adding it to the dictionary if it is met for the first time.
+    // Ids of released terms are reused.
+    TermId Intern(std::string_view word);
+
+    // Returns INVALID_TERM_ID if the word is not in the dictionary
+    TermId Find(std::string_view word) const;
+
+    std::string_view GetTerm(TermId term_id) const;
+
+    // Upper bound of term ids handed out so far
+    size_t GetTermCount() const;
+
+    // Removes the term from the dictionary, its text stays in the storage until Compact
+    void Release(TermId term_id);
+
+    size_t GetStoredBytes() const;
+
+    size_t GetReleasedBytes() const;
+
+    // Moves texts of live terms into a new storage and returns the previous one.
+    // Views obtained before the call point into the returned storage and have to be
+    // rewritten while it is still alive.
+    TextArena Compact();
+
+private:
+    TextArena arena_;
+    // Term id is the index of the view into arena_
+    std::vector<std::string_view> id_to_term_;
+    std::vector<bool> is_released_;
+    std::vector<TermId> released_ids_;
+    size_t released_bytes_ = 0;
+    // Length of terms stored outside of arena_
+    size_t external_bytes_ = 0;
+    std::unordered_map<std::string_view, TermId> term_to_id_;
+};
@@ -0,0 +1,32 @@
+#include "term_statistics.h"
+
+#include <cmath>
+
+using namespace std;
+
+int TermStatistics::GetDocumentCount(TermId term_id) const {
+    const size_t chunk_index = term_id / CHUNK_SIZE;
+    if (chunk_index >= chunks_.size()) {
+        return 0;
+    }
+    return (*chunks_[chunk_index])[term_id % CHUNK_SIZE].document_count;
+}
+
+double TermStatistics::GetLogDocumentCount(TermId term_id) const {
+    return (*chunks_[term_id / CHUNK_SIZE])[term_id % CHUNK_SIZE].log_document_count;
+}
+
+void TermStatistics::AddDocuments(TermId term_id, int delta) {
+    const size_t chunk_index = term_id / CHUNK_SIZE;
+    while (chunks_.size() <= chunk_index) {
+        chunks_.push_back(make_shared<Chunk>());
+    }
+    shared_ptr<Chunk>& chunk = chunks_[chunk_index];
+    if (chunk.use_count() > 1) {
+        // The chunk is shared with another copy of the table, which may be in use
+        chunk = make_shared<Chunk>(*chunk);
+    }
+    Entry& entry = (*chunk)[term_id % CHUNK_SIZE];
+    entry.document_count += delta;
+    entry.log_document_count = log(entry.document_count);
+}
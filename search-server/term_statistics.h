@@ -0,0 +1,32 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "term_dictionary.h"
+
+// Number of live documents containing every term, with its logarithm kept next to it,
+// so the inverse document frequency is log(N) - GetLogDocumentCount(term_id).
+// Copies share the table in chunks, a chunk is copied before it is changed.
+class TermStatistics {
+public:
+    static const size_t CHUNK_SIZE = 1024;
+
+    int GetDocumentCount(TermId term_id) const;
+
+    // Undefined for terms which are not met in live documents
+    double GetLogDocumentCount(TermId term_id) const;
+
+    void AddDocuments(TermId term_id, int delta);
+
+private:
+    struct Entry {
+        int document_count = 0;
+        double log_document_count = 0.0;
+    };
+
+    using Chunk = std::array<Entry, CHUNK_SIZE>;
+
+    std::vector<std::shared_ptr<Chunk>> chunks_;
+};
@@ -308,6 +308,1166 @@ void TestProcessQueries() {
     }
 }
 
+void TestTermDictionary() {
+    {
+        TermDictionary terms;
+        const TermId cat_id = terms.Intern("cat"s);
+        const TermId dog_id = terms.Intern("dog"s);
+        ASSERT_HINT(cat_id != dog_id, "Different words should get different ids"s);
+        ASSERT_EQUAL_HINT(terms.Intern("cat"s), cat_id,
+                          "Interning the same word twice should return the same id"s);
+        ASSERT_EQUAL(terms.Find("dog"s), dog_id);
+        ASSERT_EQUAL_HINT(terms.Find("bird"s), INVALID_TERM_ID,
+                          "Unknown word should not be found"s);
+        ASSERT_EQUAL(terms.GetTerm(cat_id), "cat"s);
+        ASSERT_EQUAL(terms.GetTermCount(), 2u);
+    }
+}
+
+void TestPostingList() {
+    {
+        PostingList postings;
+        const int document_count = 1000;
+        // Ids come in scrambled order, so blocks get split in the middle of the list
+        for (int i = 0; i < document_count; ++i) {
+            const int document_id = (i * 7919) % document_count;
+            postings.Insert(document_id, document_id % 5 + 1, (document_id % 5 + 1) / 10.0);
+        }
+        for (int document_id = 0; document_id < document_count; document_id += 3) {
+            ASSERT(postings.Erase(document_id));
+        }
+        ASSERT_HINT(!postings.Erase(3), "Erased document should not be erased twice"s);
+        ASSERT_HINT(!postings.Erase(document_count), "Unknown document should not be erased"s);
+
+        vector<int> document_ids;
+        bool counts_are_correct = true;
+        postings.ForEach([&](int document_id, uint32_t term_count) {
+            document_ids.push_back(document_id);
+            counts_are_correct = counts_are_correct
+                                 && term_count == static_cast<uint32_t>(document_id % 5 + 1);
+        });
+        ASSERT_HINT(counts_are_correct, "Term counts should be kept for every document"s);
+        ASSERT_EQUAL(postings.size(), document_ids.size());
+        ASSERT_EQUAL(document_ids.size(), 666u);
+        ASSERT_HINT(is_sorted(document_ids.begin(), document_ids.end()),
+                    "Postings should be sorted by document id"s);
+        ASSERT(postings.Contains(1));
+        ASSERT(postings.Contains(998));
+        ASSERT(!postings.Contains(999));
+
+        PostingCursor cursor(postings.GetView());
+        vector<int> cursor_ids;
+        bool bounds_are_correct = true;
+        for (; !cursor.IsEnd(); cursor.Next()) {
+            cursor_ids.push_back(cursor.GetDocumentId());
+            cursor.ShallowAdvance(cursor.GetDocumentId());
+            bounds_are_correct = bounds_are_correct
+                                 && cursor.GetBlockMaxTermFreq() >= cursor.GetTermCount() / 10.0
+                                 && cursor.GetBlockLastDocumentId() >= cursor.GetDocumentId();
+        }
+        ASSERT(cursor_ids == document_ids);
+        ASSERT_HINT(bounds_are_correct, "Block bounds should cover every posting"s);
+        ASSERT(postings.GetView().GetMaxTermFreq() >= 0.5);
+
+        PostingCursor skipping_cursor(postings.GetView());
+        skipping_cursor.Advance(3);
+        ASSERT_EQUAL(skipping_cursor.GetDocumentId(), 4);
+        skipping_cursor.Advance(501);
+        ASSERT_EQUAL(skipping_cursor.GetDocumentId(), 502);
+        skipping_cursor.Advance(999);
+        ASSERT(skipping_cursor.IsEnd());
+    }
+}
+
+void TestRemoveDocumentReleasesTerms() {
+    {
+        SearchServer server("and with"s);
+        server.AddDocument(0, "curly cat and curly tail"s, DocumentStatus::ACTUAL, {1});
+        // Enough unique long words to make the term storage compact itself
+        const string long_suffix(200, 'x');
+        for (int document_id = 1; document_id <= 1000; ++document_id) {
+            server.AddDocument(document_id, "word"s + to_string(document_id) + long_suffix,
+                               DocumentStatus::ACTUAL, {1});
+        }
+        for (int document_id = 1; document_id <= 1000; ++document_id) {
+            if (document_id % 2 == 0) {
+                server.RemoveDocument(document_id);
+            } else {
+                server.RemoveDocument(execution::par, document_id);
+            }
+        }
+        ASSERT_EQUAL(server.GetDocumentCount(), 1);
+        ASSERT_HINT(server.GetWordFrequencies(1).empty(),
+                    "Removed document should not have word frequencies"s);
+        const auto& word_freqs = server.GetWordFrequencies(0);
+        ASSERT_EQUAL(word_freqs.size(), 3u);
+        ASSERT_EQUAL(word_freqs.begin()->first, "cat"s);
+        ASSERT_EQUAL(word_freqs.at("curly"s), 0.5);
+        ASSERT_HINT(server.FindTopDocuments("word1"s + long_suffix).empty(),
+                    "Words of removed documents should not be found"s);
+        const auto found_docs = server.FindTopDocuments("curly tail"s);
+        ASSERT_EQUAL(found_docs.size(), 1u);
+        ASSERT_EQUAL(found_docs[0].id, 0);
+    }
+}
+
+void TestReAddedDocument() {
+    {
+        SearchServer server("and with"s);
+        server.AddDocument(10, "white cat"s, DocumentStatus::ACTUAL, {10});
+        server.AddDocument(3, "black dog"s, DocumentStatus::ACTUAL, {3});
+        server.AddDocument(7, "white dog"s, DocumentStatus::BANNED, {7});
+        server.RemoveDocument(3);
+        server.AddDocument(3, "black cat"s, DocumentStatus::IRRELEVANT, {-3});
+        ASSERT_EQUAL(vector<int>(server.begin(), server.end()), vector<int>({3, 7, 10}));
+
+        const auto found_docs = server.FindTopDocuments("black"s, DocumentStatus::IRRELEVANT);
+        ASSERT_EQUAL(found_docs.size(), 1u);
+        ASSERT_EQUAL(found_docs[0].id, 3);
+        ASSERT_EQUAL_HINT(found_docs[0].rating, -3,
+                          "Re-added document should get the new rating"s);
+        ASSERT_HINT(server.FindTopDocuments("dog"s, DocumentStatus::IRRELEVANT).empty(),
+                    "Words of the removed version should not be found"s);
+        const auto [words, status] = server.MatchDocument("white dog"s, 7);
+        ASSERT_EQUAL(words.size(), 2u);
+        ASSERT_EQUAL(status, DocumentStatus::BANNED);
+    }
+}
+
+void TestAddDocuments() {
+    const vector<string> texts = {
+        "funny pet and nasty rat"s,
+        "funny pet with curly hair"s,
+        "funny pet and not very nasty rat"s,
+        "pet with rat and rat and rat"s,
+        "nasty rat with curly hair"s,
+    };
+    SearchServer expected_server("and with"s);
+    vector<DocumentInput> documents;
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        expected_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id, 1});
+        documents.push_back({id, texts[id], DocumentStatus::ACTUAL, {id, 1}});
+    }
+    {
+        SearchServer server("and with"s);
+        server.AddDocuments(execution::par, documents);
+        ASSERT_EQUAL(server.GetDocumentCount(), expected_server.GetDocumentCount());
+        for (const string& query : {"nasty rat -not"s, "curly pet"s, "funny"s}) {
+            const auto found_docs = server.FindTopDocuments(query);
+            const auto expected_docs = expected_server.FindTopDocuments(query);
+            ASSERT_EQUAL(found_docs.size(), expected_docs.size());
+            for (size_t i = 0; i < found_docs.size(); ++i) {
+                ASSERT_EQUAL(found_docs[i].id, expected_docs[i].id);
+                ASSERT(abs(found_docs[i].relevance - expected_docs[i].relevance) < EPSILON);
+            }
+        }
+        ASSERT(server.GetWordFrequencies(3) == expected_server.GetWordFrequencies(3));
+    }
+    {
+        SearchServer server("and with"s);
+        documents.push_back({2, "duplicate id"sv, DocumentStatus::ACTUAL, {}});
+        try {
+            server.AddDocuments(execution::par, documents);
+            ASSERT_HINT(false, "Batch with a duplicate id should be rejected"s);
+        } catch (const invalid_argument&) {
+        }
+        ASSERT_EQUAL_HINT(server.GetDocumentCount(), 0,
+                          "Rejected batch should not add any document"s);
+    }
+}
+
+void TestSegmentedIndex() {
+    const vector<string> texts = {
+        "funny pet and nasty rat"s,
+        "funny pet with curly hair"s,
+        "funny pet and not very nasty rat"s,
+        "pet with rat and rat and rat"s,
+        "nasty rat with curly hair"s,
+        "curly dog and funny cat"s,
+        "big dog with nasty eyes"s,
+    };
+    SearchServer expected_server("and with"s);
+    SearchServer server("and with"s);
+    // Small segments make most documents go to sealed segments
+    server.SetMutableSegmentSize(2);
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        expected_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id});
+        server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id});
+    }
+    for (int id : {1, 6}) {
+        expected_server.RemoveDocument(id);
+        server.RemoveDocument(id);
+    }
+    ASSERT_EQUAL(server.GetDocumentCount(), 5);
+    for (const string& query : {"nasty rat -not"s, "curly pet"s, "funny dog"s}) {
+        const auto found_docs = server.FindTopDocuments(query);
+        const auto found_docs_par = server.FindTopDocuments(execution::par, query);
+        const auto expected_docs = expected_server.FindTopDocuments(query);
+        ASSERT_EQUAL(found_docs.size(), expected_docs.size());
+        ASSERT_EQUAL(found_docs_par.size(), expected_docs.size());
+        for (size_t i = 0; i < found_docs.size(); ++i) {
+            ASSERT_EQUAL(found_docs[i].id, expected_docs[i].id);
+            ASSERT_EQUAL(found_docs_par[i].id, expected_docs[i].id);
+            ASSERT(abs(found_docs[i].relevance - expected_docs[i].relevance) < EPSILON);
+        }
+    }
+    const string raw_query = "nasty curly rat"s;
+    const auto [words, status] = server.MatchDocument(raw_query, 4);
+    ASSERT_EQUAL(words, vector<string_view>({"curly"sv, "nasty"sv, "rat"sv}));
+}
+
+void TestConcurrentReadsAndWrites() {
+    SearchServer server("and with"s);
+    server.SetMutableSegmentSize(4);
+    for (int id = 0; id < 10; ++id) {
+        server.AddDocument(id, "funny pet cat"s, DocumentStatus::ACTUAL, {id});
+    }
+    // Readers query a word the writer never touches, so the result must not change
+    atomic_bool is_writing = true;
+    atomic_bool is_stable = true;
+    thread reader([&server, &is_writing, &is_stable] {
+        while (is_writing) {
+            const auto found_docs = server.FindTopDocuments("cat -dog"s);
+            const auto found_docs_par = server.FindTopDocuments(execution::par, "cat -dog"s);
+            const string raw_query = "pet dog"s;
+            const auto [words, status] = server.MatchDocument(raw_query, 9);
+            if (found_docs.size() != MAX_RESULT_DOCUMENT_COUNT
+                || found_docs_par.size() != MAX_RESULT_DOCUMENT_COUNT
+                || found_docs[0].id != 9 || words != vector<string_view>{"pet"sv}) {
+                is_stable = false;
+            }
+        }
+    });
+    for (int id = 10; id < 200; ++id) {
+        server.AddDocument(id, "nasty dog"s + to_string(id), DocumentStatus::ACTUAL, {1});
+        if (id % 3 == 0) {
+            server.RemoveDocument(id - 1);
+        }
+    }
+    is_writing = false;
+    reader.join();
+    ASSERT(is_stable);
+    ASSERT(server.FindTopDocuments("dog199"s).size() == 1);
+}
+
+// Names are unique per run, so runs of the tests at the same time do not share files
+static string MakeTemporaryPath(const string& name) {
+    static const string suffix = to_string(random_device()()) + "_"s
+        + to_string(chrono::system_clock::now().time_since_epoch().count());
+    return (filesystem::temp_directory_path() / (name + "_"s + suffix)).string();
+}
+
+void TestSaveAndOpen() {
+    const string path = MakeTemporaryPath("search_server_test.index"s);
+    SearchServer server("and with"s);
+    server.SetMutableSegmentSize(2);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::BANNED, {1, 2});
+    server.AddDocument(3, "big dog with nasty eyes"s, DocumentStatus::ACTUAL, {1, 3, 2});
+    server.AddDocument(5, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, {4});
+    server.RemoveDocument(3);
+    server.Save(path);
+
+    SearchServer opened_server = SearchServer::Open(path);
+    ASSERT_EQUAL(opened_server.GetDocumentCount(), 3);
+    ASSERT(vector<int>(opened_server.begin(), opened_server.end()) == vector<int>({1, 2, 5}));
+    for (const string& query : {"nasty rat -funny"s, "curly pet"s, "dog"s, "and"s}) {
+        const auto found_docs = opened_server.FindTopDocuments(query);
+        const auto expected_docs = server.FindTopDocuments(query);
+        ASSERT_EQUAL(found_docs.size(), expected_docs.size());
+        for (size_t i = 0; i < found_docs.size(); ++i) {
+            ASSERT_EQUAL(found_docs[i].id, expected_docs[i].id);
+            ASSERT_EQUAL(found_docs[i].rating, expected_docs[i].rating);
+            ASSERT(abs(found_docs[i].relevance - expected_docs[i].relevance) < EPSILON);
+        }
+    }
+    const string raw_query = "curly pet"s;
+    const auto [words, status] = opened_server.MatchDocument(raw_query, 2);
+    ASSERT_EQUAL(words, vector<string_view>({"curly"sv, "pet"sv}));
+    ASSERT(status == DocumentStatus::BANNED);
+    ASSERT(opened_server.GetWordFrequencies(5) == server.GetWordFrequencies(5));
+
+    // The opened index accepts changes like a built one
+    opened_server.RemoveDocument(1);
+    opened_server.AddDocument(4, "nasty cat"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(opened_server.FindTopDocuments("funny"s).size(), 0u);
+    ASSERT_EQUAL(opened_server.FindTopDocuments("nasty"s).size(), 2u);
+
+    // Sections pointing out of the file are reported on open, a copy is corrupted as the
+    // opened server maps the original
+    const string corrupt_path = path + ".corrupt"s;
+    const auto open_corrupted = [&path, &corrupt_path](IndexSection section, auto item) {
+        filesystem::copy_file(path, corrupt_path, filesystem::copy_options::overwrite_existing);
+        {
+            fstream file(corrupt_path, ios::in | ios::out | ios::binary);
+            IndexFileHeader header;
+            file.read(reinterpret_cast<char*>(&header), sizeof(header));
+            file.seekp(header.sections[static_cast<size_t>(section)].offset);
+            file.write(reinterpret_cast<const char*>(&item), sizeof(item));
+        }
+        try {
+            SearchServer::Open(corrupt_path);
+            ASSERT_HINT(false, "Corrupt index file should not be opened"s);
+        } catch (const runtime_error&) {
+        }
+    };
+    open_corrupted(IndexSection::POSTING_BLOCKS,
+                   PostingBlock{1, numeric_limits<uint32_t>::max(), 1, 1.0f});
+    open_corrupted(IndexSection::POSTING_TERM_IDS, numeric_limits<TermId>::max() - 1);
+    open_corrupted(IndexSection::ID_TO_ORDINAL, pair{1, numeric_limits<int>::max()});
+    filesystem::remove(corrupt_path);
+    filesystem::remove(path);
+
+    try {
+        SearchServer::Open(path);
+        ASSERT_HINT(false, "Missing index file should not be opened"s);
+    } catch (const runtime_error&) {
+    }
+}
+
+void TestWriteAheadLog() {
+    const string log_path = MakeTemporaryPath("search_server_test.log"s);
+    const string index_path = MakeTemporaryPath("search_server_test_wal.index"s);
+    filesystem::remove(log_path);
+    {
+        SearchServer server("and with"s);
+        server.OpenLog(log_path);
+        server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+        server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::BANNED, {1, 2});
+        server.RemoveDocument(1);
+        server.SyncLog();
+    }
+    {
+        SearchServer server("and with"s);
+        server.OpenLog(log_path);
+        ASSERT_EQUAL(server.GetDocumentCount(), 1);
+        ASSERT_EQUAL(server.FindTopDocuments("curly"s, DocumentStatus::BANNED).size(), 1u);
+        ASSERT_EQUAL(server.FindTopDocuments("curly"s, DocumentStatus::BANNED)[0].rating, 1);
+        // Saved mutations are dropped from the log, later ones are replayed on the index
+        server.Save(index_path);
+        server.AddDocument(3, "big dog with nasty eyes"s, DocumentStatus::ACTUAL, {3});
+        server.RemoveDocument(2);
+    }
+    {
+        // A record torn by a crash is ignored
+        ofstream log(log_path, ios::binary | ios::app);
+        log << "torn"s;
+    }
+    {
+        SearchServer server = SearchServer::Open(index_path);
+        server.OpenLog(log_path);
+        ASSERT(vector<int>(server.begin(), server.end()) == vector<int>({3}));
+        server.AddDocument(4, "nasty cat"s, DocumentStatus::ACTUAL, {1});
+    }
+    {
+        SearchServer server = SearchServer::Open(index_path);
+        server.OpenLog(log_path);
+        ASSERT(vector<int>(server.begin(), server.end()) == vector<int>({3, 4}));
+        ASSERT_EQUAL(server.FindTopDocuments("nasty"s).size(), 2u);
+    }
+    {
+        // The log is closed when its replay throws
+        const auto count_descriptors = [] {
+            return distance(filesystem::directory_iterator("/proc/self/fd"s),
+                            filesystem::directory_iterator());
+        };
+        const auto descriptor_count = count_descriptors();
+        try {
+            WriteAheadLog log(log_path, {}, [](const LogRecord&) {
+                throw runtime_error("Replay failed"s);
+            });
+            ASSERT_HINT(false, "Replay error should be thrown by the constructor"s);
+        } catch (const runtime_error&) {
+        }
+        ASSERT_EQUAL(count_descriptors(), descriptor_count);
+    }
+    filesystem::remove(log_path);
+    filesystem::remove(index_path);
+}
+
+void TestRemovedDocumentsArePurged() {
+    const vector<string> texts = {
+        "funny pet and nasty rat"s,
+        "funny pet with curly hair"s,
+        "funny pet and not very nasty rat"s,
+        "pet with rat and rat and rat"s,
+        "nasty rat with curly hair"s,
+        "curly dog and funny cat"s,
+    };
+    SearchServer expected_server("and with"s);
+    SearchServer server("and with"s);
+    server.SetMutableSegmentSize(2);
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id});
+        if (id % 2 == 1) {
+            expected_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id});
+        }
+    }
+    const auto check_equal = [&server, &expected_server] {
+        ASSERT_EQUAL(server.GetDocumentCount(), expected_server.GetDocumentCount());
+        for (const string& query : {"nasty rat"s, "curly pet -dog"s, "funny"s}) {
+            const auto found_docs = server.FindTopDocuments(query);
+            const auto found_docs_par = server.FindTopDocuments(execution::par, query);
+            const auto expected_docs = expected_server.FindTopDocuments(query);
+            ASSERT_EQUAL(found_docs.size(), expected_docs.size());
+            ASSERT_EQUAL(found_docs_par.size(), expected_docs.size());
+            for (size_t i = 0; i < found_docs.size(); ++i) {
+                ASSERT_EQUAL(found_docs[i].id, expected_docs[i].id);
+                ASSERT_EQUAL(found_docs_par[i].id, expected_docs[i].id);
+                ASSERT(abs(found_docs[i].relevance - expected_docs[i].relevance) < EPSILON);
+            }
+        }
+    };
+    // Removed documents are skipped and not counted before their postings are purged
+    for (int id : {0, 2, 4}) {
+        server.RemoveDocument(id);
+    }
+    check_equal();
+    try {
+        const string raw_query = "nasty"s;
+        server.MatchDocument(raw_query, 2);
+        ASSERT_HINT(false, "Removed document should not be matched"s);
+    } catch (const out_of_range&) {
+    }
+    server.PurgeRemovedDocuments();
+    check_equal();
+    // A purged segment is purged again without losing the documents removed earlier
+    server.RemoveDocument(3);
+    expected_server.RemoveDocument(3);
+    server.PurgeRemovedDocuments();
+    check_equal();
+
+    server.AddDocument(2, texts[2], DocumentStatus::ACTUAL, {2});
+    expected_server.AddDocument(2, texts[2], DocumentStatus::ACTUAL, {2});
+    check_equal();
+}
+
+void TestTombstones() {
+    Tombstones tombstones;
+    for (int ordinal : {3, 64, 4100, 9000}) {
+        tombstones.Add(ordinal);
+    }
+    const Tombstones copy = tombstones;
+    tombstones.Erase(64);
+    ASSERT(copy.Contains(64));
+    ASSERT(!tombstones.Contains(64));
+    ASSERT(!tombstones.Contains(65));
+    ASSERT(tombstones.ContainsAny(4000, 5000));
+    ASSERT(!tombstones.ContainsAny(10, 4100));
+    vector<int> ordinals;
+    tombstones.ForEach(3, 9000, [&ordinals](int ordinal) {
+        ordinals.push_back(ordinal);
+    });
+    ASSERT_EQUAL(ordinals, (vector<int>{3, 4100}));
+}
+
+void TestTermStatistics() {
+    TermStatistics statistics;
+    ASSERT_EQUAL(statistics.GetDocumentCount(5), 0);
+    statistics.AddDocuments(5, 3);
+    statistics.AddDocuments(5000, 1);
+    ASSERT_EQUAL(statistics.GetDocumentCount(5), 3);
+    ASSERT_EQUAL(statistics.GetDocumentCount(5000), 1);
+    ASSERT(abs(statistics.GetLogDocumentCount(5) - log(3)) < EPSILON);
+
+    // Changes of a copy are not seen through the original
+    TermStatistics copy = statistics;
+    copy.AddDocuments(5, -1);
+    copy.AddDocuments(6, 1);
+    ASSERT_EQUAL(copy.GetDocumentCount(5), 2);
+    ASSERT_EQUAL(copy.GetDocumentCount(6), 1);
+    ASSERT_EQUAL(statistics.GetDocumentCount(5), 3);
+    ASSERT_EQUAL(statistics.GetDocumentCount(6), 0);
+    ASSERT(abs(copy.GetLogDocumentCount(5) - log(2)) < EPSILON);
+}
+
+void TestTopDocumentsPage() {
+    SearchServer server(""s);
+    for (int id = 0; id < 20; ++id) {
+        server.AddDocument(id, "white cat"s, DocumentStatus::ACTUAL, {id});
+    }
+    server.AddDocument(20, "cat"s, DocumentStatus::ACTUAL, {0});
+    server.AddDocument(21, "dog"s, DocumentStatus::ACTUAL, {0});
+
+    const auto top = server.FindTopDocuments("cat"s);
+    ASSERT_EQUAL(top.size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    ASSERT_EQUAL(top[0].id, 20);
+    // Equal relevance is ordered by rating
+    const auto page = server.FindTopDocuments("cat"s, SearchOptions{7, 4});
+    ASSERT_EQUAL(page.size(), 7u);
+    for (size_t i = 0; i < page.size(); ++i) {
+        ASSERT_EQUAL(page[i].id, 16 - static_cast<int>(i));
+    }
+    const auto par_page = server.FindTopDocuments(execution::par, "cat"s, SearchOptions{7, 4});
+    ASSERT_EQUAL(par_page.size(), 7u);
+    ASSERT_EQUAL(par_page.back().id, page.back().id);
+
+    const auto tail = server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, {100, 18});
+    ASSERT_EQUAL(tail.size(), 3u);
+    ASSERT_EQUAL(tail.back().id, 0);
+    ASSERT(server.FindTopDocuments("cat"s, SearchOptions{5, 21}).empty());
+    ASSERT(server.FindTopDocuments("cat"s, SearchOptions{0, 0}).empty());
+}
+
+void TestBlockMaxWand() {
+    SearchServer server("w0"s);
+    server.SetMutableSegmentSize(64);
+    for (int id = 0; id < 2000; ++id) {
+        // Words with small moduli are common
+        string text;
+        for (int i = 0; i < 3 + id % 5; ++i) {
+            text += "w"s + to_string((id * (i + 3) + i * i) % (5 + i * 7)) + " "s;
+        }
+        server.AddDocument(id, text, id % 4 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL,
+                           {id});
+    }
+    for (int id = 0; id < 2000; id += 7) {
+        server.RemoveDocument(id);
+    }
+    const auto is_odd = [](int document_id, DocumentStatus, int) {
+        return document_id % 2 == 1;
+    };
+    for (const string& query : {"w1 w2 w3"s, "w1 w4 w10 -w3"s, "w2 w12 w20 w30"s, "w0 w5"s}) {
+        for (const SearchOptions& page : {SearchOptions{}, SearchOptions{20, 0},
+                                          SearchOptions{10, 30}}) {
+            SearchOptions pruned_page = page;
+            pruned_page.mode = QueryMode::BLOCK_MAX_WAND;
+            const vector<vector<Document>> results = {
+                server.FindTopDocuments(query, page),
+                server.FindTopDocuments(query, pruned_page),
+                server.FindTopDocuments(execution::par, query, pruned_page),
+                server.FindTopDocuments(query, is_odd, page),
+                server.FindTopDocuments(query, is_odd, pruned_page),
+            };
+            for (size_t i : {1u, 2u, 4u}) {
+                const vector<Document>& expected = results[i == 4 ? 3 : 0];
+                ASSERT_EQUAL(results[i].size(), expected.size());
+                for (size_t j = 0; j < expected.size(); ++j) {
+                    ASSERT_EQUAL(results[i][j].id, expected[j].id);
+                    ASSERT_EQUAL(results[i][j].relevance, expected[j].relevance);
+                }
+            }
+        }
+    }
+}
+
+void TestRelevanceAccumulator() {
+    RelevanceAccumulator& accumulator = RelevanceAccumulator::GetThreadLocal();
+    accumulator.Reset(10);
+    accumulator.Add(7, 0.5);
+    accumulator.Add(2, 1.0);
+    accumulator.Add(7, 0.25);
+    accumulator.Add(4, 1.0);
+    accumulator.Exclude(4);
+    accumulator.Exclude(9);
+    ASSERT((accumulator.GetScored() == vector<uint32_t>{2, 7}));
+    ASSERT_EQUAL(accumulator.GetRelevance(7), 0.75);
+
+    // Entries of the previous segment are cleared
+    accumulator.Reset(20);
+    accumulator.Add(7, 0.125);
+    accumulator.Add(15, 1.0);
+    ASSERT((accumulator.GetScored() == vector<uint32_t>{7, 15}));
+    ASSERT_EQUAL(accumulator.GetRelevance(7), 0.125);
+}
+
+void TestParallelQueryPartitions() {
+    SearchServer server(""s);
+    // Enough documents for a segment to be split into several partitions
+    const int document_count = QUERY_PARTITION_DOCUMENT_COUNT + 5000;
+    vector<DocumentInput> documents;
+    vector<string> texts;
+    texts.reserve(document_count);
+    for (int id = 0; id < document_count; ++id) {
+        texts.push_back("cat"s + (id % 3 == 0 ? " dog"s : ""s) + (id % 5 == 0 ? " rat"s : ""s));
+        documents.push_back({id, texts.back(), DocumentStatus::ACTUAL, {id % 1000}});
+    }
+    server.AddDocuments(documents);
+    server.RemoveDocument(QUERY_PARTITION_DOCUMENT_COUNT + 999);
+    for (const string& query : {"cat dog"s, "cat -rat"s, "rat -dog"s}) {
+        const SearchOptions page{10, 5};
+        const auto expected = server.FindTopDocuments(query, page);
+        const auto found = server.FindTopDocuments(execution::par, query, page);
+        ASSERT_EQUAL(found.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_EQUAL(found[i].relevance, expected[i].relevance);
+            ASSERT_EQUAL(found[i].rating, expected[i].rating);
+        }
+    }
+}
+
+void TestConcurrentMap() {
+    const int key_count = 10000;
+    const int thread_count = 4;
+    // Small tables, so they get sealed and chained while threads insert
+    ConcurrentMap<int, double> relevances(3);
+    ConcurrentMap<int64_t, int> counts(3, key_count);
+    ConcurrentMap<int, string> texts(2);
+    vector<thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&relevances, &counts, &texts, t]() {
+            for (int i = 0; i < key_count; ++i) {
+                const int key = (i * 7919 + t * 13) % key_count - key_count / 2;
+                relevances[key].ref_to_value += 0.25;
+                relevances.Add(key, 0.25);
+                counts.Add(key, 1);
+                if (key % 100 == 0) {
+                    texts[key].ref_to_value += "x"s;
+                }
+            }
+        });
+    }
+    for (thread& worker : threads) {
+        worker.join();
+    }
+    relevances.Erase(0);
+    relevances.Erase(key_count);
+    counts.Erase(1);
+    counts[1].ref_to_value += 5;
+
+    const map<int, double> relevance_map = relevances.BuildOrdinaryMap();
+    ASSERT_EQUAL(relevance_map.size(), static_cast<size_t>(key_count - 1));
+    ASSERT(relevance_map.count(0) == 0);
+    bool values_are_correct = true;
+    for (const auto& [key, relevance] : relevance_map) {
+        values_are_correct = values_are_correct && relevance == 0.5 * thread_count;
+    }
+    ASSERT_HINT(values_are_correct, "Concurrent updates should not be lost"s);
+
+    const vector<pair<int64_t, int>> count_items = counts.Extract();
+    ASSERT_EQUAL(count_items.size(), static_cast<size_t>(key_count));
+    ASSERT(is_sorted(count_items.begin(), count_items.end()));
+    ASSERT_EQUAL(count_items.front().first, -key_count / 2);
+    ASSERT_EQUAL(count_items.front().second, thread_count);
+    ASSERT_EQUAL(counts[1].ref_to_value, 5);
+
+    const map<int, string> text_map = texts.BuildOrdinaryMap();
+    ASSERT_EQUAL(text_map.size(), static_cast<size_t>(key_count / 100));
+    ASSERT_EQUAL(text_map.at(100), string(thread_count, 'x'));
+}
+
+void TestIdKernels() {
+    mt19937 generator(17);
+    const auto make_ids = [&generator](size_t size, uint32_t range) {
+        vector<uint32_t> ids(size);
+        for (uint32_t& id : ids) {
+            id = generator() % range;
+        }
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        return ids;
+    };
+    vector<IdKernels> kernel_sets = {IdKernels::SCALAR};
+    if (GetSupportedIdKernels() != IdKernels::SCALAR) {
+        kernel_sets.push_back(IdKernels::SSE41);
+    }
+    if (GetSupportedIdKernels() == IdKernels::AVX2) {
+        kernel_sets.push_back(IdKernels::AVX2);
+    }
+    // Sizes cover empty arrays, tails shorter than a vector and galloping
+    const vector<pair<size_t, size_t>> sizes = {
+        {0, 10}, {10, 0}, {3, 5}, {17, 23}, {100, 100}, {1000, 300}, {5, 1000}, {2000, 2000}};
+    for (const auto& [lhs_size, rhs_size] : sizes) {
+        for (uint32_t range : {50u, 5000u, 4000000000u}) {
+            const vector<uint32_t> lhs = make_ids(lhs_size, range);
+            const vector<uint32_t> rhs = make_ids(rhs_size, range);
+            vector<uint32_t> intersection;
+            set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                             back_inserter(intersection));
+            vector<uint32_t> difference;
+            set_difference(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                           back_inserter(difference));
+            for (IdKernels kernels : kernel_sets) {
+                vector<uint32_t> out(lhs.size());
+                out.resize(IntersectIds(lhs, rhs, out.data(), kernels));
+                ASSERT(out == intersection);
+                // In place
+                out = lhs;
+                out.resize(SubtractIds(out, rhs, out.data(), kernels));
+                ASSERT(out == difference);
+            }
+        }
+    }
+
+    const vector<uint32_t> ids = {1, 3, 5, 7, 9, 11, 13, 15, 17, 19};
+    ASSERT_EQUAL(GallopIds(ids, 0, 0), 0u);
+    ASSERT_EQUAL(GallopIds(ids, 0, 9), 4u);
+    ASSERT_EQUAL(GallopIds(ids, 2, 2), 2u);
+    ASSERT_EQUAL(GallopIds(ids, 3, 18), 9u);
+    ASSERT_EQUAL(GallopIds(ids, 0, 20), ids.size());
+}
+
+void TestMatchDocuments() {
+    SearchServer server("and with"s);
+    server.SetMutableSegmentSize(3);
+    const vector<string> texts = {
+        "funny pet and nasty rat"s,
+        "funny pet with curly hair"s,
+        "funny pet and not very nasty rat"s,
+        "pet with rat and rat and rat"s,
+        "nasty rat with curly hair"s,
+        "curly dog and funny cat"s,
+        "big dog with nasty eyes"s,
+    };
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        server.AddDocument(id * 10, texts[id], static_cast<DocumentStatus>(id % 3), {id});
+    }
+    server.RemoveDocument(30);
+    // Any order, repeated ids and documents from every segment
+    const vector<int> document_ids = {60, 0, 40, 10, 0, 50, 20};
+    for (const string& query : {"nasty curly rat"s, "funny pet -not"s, "dog -eyes rat"s, "pig"s}) {
+        const auto results = server.MatchDocuments(query, document_ids);
+        const auto results_par = server.MatchDocuments(execution::par, query, document_ids);
+        ASSERT_EQUAL(results.size(), document_ids.size());
+        for (size_t i = 0; i < document_ids.size(); ++i) {
+            const auto [words, status] = server.MatchDocument(query, document_ids[i]);
+            ASSERT_EQUAL(get<0>(results[i]), words);
+            ASSERT_EQUAL(get<0>(results_par[i]), words);
+            ASSERT(get<1>(results[i]) == status);
+            ASSERT(get<1>(results_par[i]) == status);
+        }
+    }
+
+    try {
+        server.MatchDocuments("funny"s, {0, 30});
+        ASSERT_HINT(false, "Removed document must not be matched"s);
+    } catch (const out_of_range&) {
+    }
+}
+
+void TestPreparedQuery() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(3, "big cat with nasty eyes"s, DocumentStatus::BANNED, {5});
+    const auto expect_same = [&server](const PreparedQuery& prepared, const string& raw_query) {
+        const auto expected = server.FindTopDocuments(raw_query);
+        const auto found = server.FindTopDocuments(prepared);
+        const auto found_par = server.FindTopDocuments(execution::par, prepared);
+        ASSERT_EQUAL(found.size(), expected.size());
+        ASSERT_EQUAL(found_par.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_EQUAL(found[i].id, expected[i].id);
+            ASSERT_EQUAL(found_par[i].id, expected[i].id);
+            ASSERT_EQUAL(found[i].relevance, expected[i].relevance);
+        }
+        const auto banned = server.FindTopDocuments(prepared, DocumentStatus::BANNED);
+        ASSERT_EQUAL(banned.size(), server.FindTopDocuments(raw_query, DocumentStatus::BANNED).size());
+    };
+
+    PreparedQuery prepared;
+    {
+        // Matched words stay valid after the text the query was prepared from is gone
+        string raw_query = "nasty pet pet -hair"s;
+        prepared = server.PrepareQuery(raw_query);
+        raw_query = "overwritten"s;
+    }
+    expect_same(prepared, "nasty pet -hair"s);
+    const auto [words, status] = server.MatchDocument(prepared, 1);
+    ASSERT_EQUAL(words, vector<string_view>({"nasty"sv, "pet"sv}));
+    const auto [words_par, status_par] = server.MatchDocument(execution::par, prepared, 1);
+    ASSERT_EQUAL(words_par, words);
+    ASSERT(get<0>(server.MatchDocument(prepared, 2)).empty());
+
+    // Term ids change with the index, the query is resolved again
+    server.RemoveDocument(1);
+    server.RemoveDocument(2);
+    server.AddDocument(4, "nasty pet"s, DocumentStatus::ACTUAL, {2});
+    server.AddDocument(5, "pet with hair"s, DocumentStatus::ACTUAL, {3});
+    expect_same(prepared, "nasty pet -hair"s);
+    ASSERT_EQUAL(get<0>(server.MatchDocument(prepared, 4)), vector<string_view>({"nasty"sv, "pet"sv}));
+
+    RequestQueue request_queue(server);
+    const PreparedQuery missing = server.PrepareQuery("sparrow"s);
+    request_queue.AddFindRequest(missing);
+    request_queue.AddFindRequest(missing, DocumentStatus::BANNED);
+    ASSERT_EQUAL(request_queue.AddFindRequest(prepared, [](int id, DocumentStatus, int) {
+        return id == 4;
+    }).size(), 1u);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 2);
+}
+
+void TestResultCache() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::BANNED, {1});
+    server.SetResultCacheCapacity(2);
+    const auto first = server.FindTopDocuments("nasty pet"s);
+    // Same normalized query
+    const auto second = server.FindTopDocuments("pet nasty pet"s);
+    ASSERT_EQUAL(second.size(), first.size());
+    ASSERT_EQUAL(second[0].id, first[0].id);
+    ResultCacheStats stats = server.GetResultCacheStats();
+    ASSERT_EQUAL(stats.misses, 1u);
+    ASSERT_EQUAL(stats.hits, 1u);
+
+    // Status and page are parts of the key
+    ASSERT_EQUAL(server.FindTopDocuments("nasty pet"s, DocumentStatus::BANNED)[0].id, 2);
+    ASSERT(server.FindTopDocuments("nasty pet"s, SearchOptions{1, 1}).empty());
+    stats = server.GetResultCacheStats();
+    ASSERT_EQUAL(stats.misses, 3u);
+    ASSERT(stats.evictions >= 1u);
+
+    // Changes of the index invalidate the results
+    const PreparedQuery query = server.PrepareQuery("curly pet"s);
+    ASSERT_EQUAL(server.FindTopDocuments(query).size(), 1u);
+    server.AddDocument(3, "curly pet"s, DocumentStatus::ACTUAL, {2});
+    ASSERT_EQUAL(server.FindTopDocuments(query).size(), 2u);
+    ASSERT_EQUAL(server.FindTopDocuments(execution::par, query).size(), 2u);
+    stats = server.GetResultCacheStats();
+    ASSERT_EQUAL(stats.hits, 2u);
+    ASSERT_EQUAL(stats.misses, 5u);
+
+    server.SetResultCacheCapacity(0);
+    server.FindTopDocuments("nasty pet"s);
+    ASSERT_EQUAL(server.GetResultCacheStats().misses, 0u);
+
+    // A query on an older snapshot misses without dropping the newer result
+    ResultCache cache(4, 1);
+    cache.Insert("pet"s, 2, {{1, 0.5, 7}});
+    ASSERT(!cache.Find("pet"s, 1).has_value());
+    ASSERT(cache.Find("pet"s, 2).has_value());
+    ASSERT(!cache.Find("pet"s, 3).has_value());
+    ASSERT(!cache.Find("pet"s, 2).has_value());
+}
+
+void TestThreadPool() {
+    ThreadPool thread_pool({2, false});
+    ASSERT_EQUAL(thread_pool.GetWorkerCount(), 2u);
+    vector<int> squares(1000);
+    thread_pool.ParallelFor(squares.size(), [&squares](size_t index) {
+        squares[index] = static_cast<int>(index * index);
+    });
+    for (size_t i = 0; i < squares.size(); ++i) {
+        ASSERT_EQUAL(squares[i], static_cast<int>(i * i));
+    }
+
+    // Callers of nested batches run their indexes themselves, so the batches finish with
+    // any number of workers
+    atomic<int> call_count{0};
+    thread_pool.ParallelFor(8, [&thread_pool, &call_count](size_t) {
+        thread_pool.ParallelFor(8, [&call_count](size_t) {
+            ++call_count;
+        });
+    });
+    ASSERT_EQUAL(call_count.load(), 64);
+
+    try {
+        thread_pool.ParallelFor(10, [](size_t index) {
+            if (index == 7) {
+                throw invalid_argument("Task failed"s);
+            }
+        });
+        ASSERT_HINT(false, "Exception of a task must be rethrown"s);
+    } catch (const invalid_argument&) {
+    }
+
+    {
+        // The task holds the last pointer to its pool, which is destroyed on another thread
+        shared_ptr<ThreadPool> pool = ThreadPool::Create({1, false});
+        const weak_ptr<ThreadPool> weak_pool = pool;
+        promise<void> release;
+        shared_future<void> released = release.get_future().share();
+        pool->Submit([pool, released]() {
+            released.wait();
+        });
+        pool.reset();
+        release.set_value();
+        while (!weak_pool.expired()) {
+            this_thread::yield();
+        }
+    }
+
+    SearchServer server("and with"s);
+    server.SetThreadPoolOptions({3, true});
+    ASSERT_EQUAL(server.GetThreadPool()->GetWorkerCount(), 3u);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1});
+    const vector<string> queries = {"nasty rat"s, "curly pet"s, "sparrow"s};
+    const auto results = ProcessQueries(server, queries);
+    for (size_t i = 0; i < queries.size(); ++i) {
+        ASSERT_EQUAL(results[i].size(), server.FindTopDocuments(queries[i]).size());
+    }
+}
+
+void TestFindTopDocumentsBatch() {
+    SearchServer server("and with"s);
+    server.SetMutableSegmentSize(16);
+    mt19937 generator(22);
+    const vector<string> vocabulary = {"cat"s, "dog"s, "rat"s, "pet"s, "funny"s, "nasty"s,
+                                       "curly"s, "hair"s, "big"s, "eyes"s, "and"s};
+    const auto make_text = [&generator, &vocabulary](int word_count) {
+        string text;
+        for (int i = 0; i < word_count; ++i) {
+            text += (i > 0 ? " "s : ""s) + vocabulary[generator() % vocabulary.size()];
+        }
+        return text;
+    };
+    for (int id = 0; id < 200; ++id) {
+        server.AddDocument(id, make_text(1 + id % 7), static_cast<DocumentStatus>(id % 4 % 3),
+                           {id % 11});
+    }
+    for (int id = 0; id < 200; id += 13) {
+        server.RemoveDocument(id);
+    }
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+        string query = make_text(1 + i % 4);
+        if (i % 3 == 0) {
+            query += " -"s + vocabulary[generator() % vocabulary.size()];
+        }
+        queries.push_back(query);
+    }
+    queries.push_back("sparrow"s);
+
+    const auto results = server.FindTopDocumentsBatch(queries);
+    ASSERT_EQUAL(results.size(), queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto expected = server.FindTopDocuments(queries[i]);
+        ASSERT_EQUAL(results[i].size(), expected.size());
+        for (size_t j = 0; j < expected.size(); ++j) {
+            ASSERT_EQUAL(results[i][j].id, expected[j].id);
+            ASSERT_EQUAL(results[i][j].relevance, expected[j].relevance);
+            ASSERT_EQUAL(results[i][j].rating, expected[j].rating);
+        }
+    }
+    ASSERT_EQUAL(ProcessQueries(server, queries).size(), queries.size());
+}
+
+void TestProcessQueriesJoinedView() {
+    {
+        SearchServer server("and with"s);
+        server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {1});
+        server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {2});
+        server.AddDocument(3, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, {3});
+        const vector<string> queries = {"sparrow"s, "curly"s, "owl"s, "nasty -curly"s, "hawk"s};
+        const vector<vector<Document>> query_documents = ProcessQueries(server, queries);
+        vector<int> expected_ids;
+        for (const vector<Document>& documents : query_documents) {
+            for (const Document& document : documents) {
+                expected_ids.push_back(document.id);
+            }
+        }
+        ASSERT_EQUAL(expected_ids.size(), 3u);
+
+        JoinedDocuments joined = ProcessQueriesJoined(server, queries);
+        ASSERT_EQUAL(joined.size(), expected_ids.size());
+        ASSERT_EQUAL(joined.GetQueryDocuments().size(), queries.size());
+        vector<int> ids;
+        for (const Document& document : joined) {
+            ids.push_back(document.id);
+        }
+        ASSERT_HINT(ids == expected_ids,
+                    "Joined documents should go query after query, skipping empty results"s);
+        vector<int> reversed_ids;
+        for (auto it = joined.end(); it != joined.begin();) {
+            reversed_ids.insert(reversed_ids.begin(), (--it)->id);
+        }
+        ASSERT_HINT(reversed_ids == expected_ids, "Reverse iteration should visit the same documents"s);
+        ASSERT_EQUAL(joined.front().id, expected_ids.front());
+
+        while (!joined.empty()) {
+            ASSERT_EQUAL(joined.back().id, expected_ids.back());
+            joined.pop_back();
+            expected_ids.pop_back();
+        }
+        ASSERT_HINT(joined.begin() == joined.end(), "Empty joined documents should have no elements"s);
+    }
+}
+
+void TestFindTopDocumentsAsync() {
+    const auto get_ids = [](const vector<Document>& documents) {
+        vector<int> ids;
+        for (const Document& document : documents) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    };
+    {
+        SearchServer server("and with"s);
+        server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {1});
+        server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {2});
+        server.AddDocument(3, "nasty rat with curly hair"s, DocumentStatus::BANNED, {3});
+        const vector<string> queries = {"funny pet"s, "curly -pet"s, "nasty"s, "sparrow"s};
+        vector<future<SearchResult>> futures;
+        for (const string& query : queries) {
+            futures.push_back(server.FindTopDocumentsAsync(query));
+        }
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const SearchResult result = futures[i].get();
+            ASSERT(!result.is_partial);
+            ASSERT_HINT(get_ids(result.documents) == get_ids(server.FindTopDocuments(queries[i])),
+                        "Asynchronous query should find what the synchronous one does"s);
+        }
+        ASSERT_HINT(get_ids(server.FindTopDocumentsAsync(server.PrepareQuery("curly"s),
+                                                         DocumentStatus::BANNED).get().documents)
+                        == vector<int>{3},
+                    "Prepared query should run asynchronously with its status"s);
+
+        CancellationSource source;
+        const CancellationToken token = source.GetToken();
+        ASSERT(!token.IsCancelled());
+        source.Cancel();
+        ASSERT(token.IsCancelled());
+        try {
+            server.FindTopDocumentsAsync("funny"s, DocumentStatus::ACTUAL, {}, token).get();
+            ASSERT_HINT(false, "Cancelled query should not run"s);
+        } catch (const QueryCancelledError&) {
+        }
+
+        const CancellationToken expired =
+            CancellationToken().WithDeadline(chrono::steady_clock::now() - 1s);
+        ASSERT(expired.IsCancelled());
+        try {
+            server.FindTopDocumentsAsync("funny"s, DocumentStatus::ACTUAL, {}, expired).get();
+            ASSERT_HINT(false, "Query past its deadline should not run"s);
+        } catch (const QueryCancelledError&) {
+        }
+        const CancellationToken distant =
+            CancellationToken().WithDeadline(chrono::steady_clock::now() + 1h);
+        ASSERT_EQUAL(server.FindTopDocumentsAsync("funny"s, DocumentStatus::ACTUAL, {},
+                                                  distant).get().documents.size(), 2u);
+
+        // A budget running out is reported, not taken for complete results
+        SearchOptions limited_options;
+        limited_options.budget.max_scored_postings = 1;
+        const SearchResult limited =
+            server.FindTopDocumentsAsync("funny nasty"s, DocumentStatus::ACTUAL,
+                                         limited_options).get();
+        ASSERT(limited.is_partial);
+
+        SearchOptions cancelled_options;
+        cancelled_options.budget.cancellation = token;
+        try {
+            server.FindTopDocumentsAsync("funny"s, DocumentStatus::ACTUAL, cancelled_options).get();
+            ASSERT_HINT(false, "Query cancelled through its budget should not run"s);
+        } catch (const QueryCancelledError&) {
+        }
+
+        try {
+            server.FindTopDocumentsAsync("funny --pet"s).get();
+            ASSERT_HINT(false, "Invalid query should be reported by the future"s);
+        } catch (const invalid_argument&) {
+        }
+    }
+    {
+        // A running scan stops at the next block once its token is cancelled
+        SearchServer server("and with"s);
+        server.SetMutableSegmentSize(1000);
+        for (int id = 0; id < 1000; ++id) {
+            server.AddDocument(id, "cat"s, DocumentStatus::ACTUAL, {id});
+        }
+        CancellationSource source;
+        SearchOptions options;
+        options.count = 1000;
+        options.budget.cancellation = source.GetToken();
+        const auto documents = server.FindTopDocuments("cat"s,
+            [&source](int, DocumentStatus, int) {
+                source.Cancel();
+                return true;
+            }, options);
+        ASSERT_EQUAL(documents.size(), POSTING_BLOCK_SIZE);
+        ASSERT_EQUAL(server.GetPartialQueryCount(), 1u);
+    }
+    {
+        // Futures dropped without waiting, the server waits for the queries itself
+        SearchServer server("and with"s);
+        server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {1});
+        for (int i = 0; i < 100; ++i) {
+            server.FindTopDocumentsAsync("funny rat"s);
+        }
+    }
+}
+
+void TestQueryBudget() {
+    SearchServer server("and with"s);
+    server.SetMutableSegmentSize(4);
+    for (int id = 0; id < 40; ++id) {
+        server.AddDocument(id, id % 3 == 0 ? "cat and dog"s : "cat with hat"s,
+                           DocumentStatus::ACTUAL, {id});
+    }
+    const auto get_ids = [](const vector<Document>& documents) {
+        vector<int> ids;
+        for (const Document& document : documents) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    };
+    const vector<int> full_ids = get_ids(server.FindTopDocuments("cat dog"s));
+
+    SearchOptions options;
+    options.budget.max_scored_postings = 1000;
+    SearchResult result = server.Search("cat dog"s, DocumentStatus::ACTUAL, options);
+    ASSERT_HINT(!result.is_partial, "Query within its budget should not be partial"s);
+    ASSERT(get_ids(result.documents) == full_ids);
+    ASSERT_EQUAL(server.GetPartialQueryCount(), 0u);
+
+    for (QueryMode mode : {QueryMode::EXHAUSTIVE, QueryMode::BLOCK_MAX_WAND}) {
+        options.mode = mode;
+        options.budget.max_scored_postings = 1;
+        result = server.Search("cat dog"s, DocumentStatus::ACTUAL, options);
+        ASSERT_HINT(result.is_partial, "Query out of its budget should be partial"s);
+        ASSERT_HINT(!result.documents.empty(),
+                    "Partial query should return the documents scored so far"s);
+    }
+    ASSERT_EQUAL(server.GetPartialQueryCount(), 2u);
+
+    options = {};
+    options.budget.deadline = chrono::steady_clock::now() - 1s;
+    result = server.Search(server.PrepareQuery("cat"s), DocumentStatus::ACTUAL, options);
+    ASSERT(result.is_partial);
+    ASSERT_HINT(result.documents.empty(), "Query past its deadline should scan nothing"s);
+    ASSERT(server.FindTopDocuments(execution::par, "cat"s, options).empty());
+    ASSERT_EQUAL(server.GetPartialQueryCount(), 4u);
+
+    {
+        // A long posting list is cut in the middle
+        SearchServer long_list_server("and with"s);
+        long_list_server.SetMutableSegmentSize(1000);
+        for (int id = 0; id < 1000; ++id) {
+            long_list_server.AddDocument(id, "cat"s, DocumentStatus::ACTUAL, {id});
+        }
+        SearchOptions long_list_options;
+        long_list_options.count = 1000;
+        long_list_options.budget.max_scored_postings = 1;
+        result = long_list_server.Search("cat"s, DocumentStatus::ACTUAL, long_list_options);
+        ASSERT(result.is_partial);
+        ASSERT_EQUAL(result.documents.size(), POSTING_BLOCK_SIZE);
+        ASSERT_EQUAL(long_list_server.FindTopDocuments(execution::par, "cat"s,
+                                                       long_list_options).size(),
+                     POSTING_BLOCK_SIZE);
+
+        // A budget spent by the last posting leaves nothing unscored
+        const uint64_t partial_query_count = long_list_server.GetPartialQueryCount();
+        long_list_options.budget.max_scored_postings = 1000;
+        for (QueryMode mode : {QueryMode::EXHAUSTIVE, QueryMode::BLOCK_MAX_WAND}) {
+            long_list_options.mode = mode;
+            result = long_list_server.Search("cat"s, DocumentStatus::ACTUAL, long_list_options);
+            ASSERT_HINT(!result.is_partial, "Query spending its whole budget is complete"s);
+            ASSERT_EQUAL(result.documents.size(), 1000u);
+            ASSERT_EQUAL(long_list_server.FindTopDocuments(execution::par, "cat"s,
+                                                           long_list_options).size(),
+                         1000u);
+        }
+        ASSERT_EQUAL(long_list_server.GetPartialQueryCount(), partial_query_count);
+    }
+    // 40 postings of "cat" and 14 of "dog"
+    options = {};
+    options.budget.max_scored_postings = 54;
+    ASSERT(!server.Search("cat dog"s, DocumentStatus::ACTUAL, options).is_partial);
+    ASSERT_EQUAL(server.FindTopDocuments(execution::par, "cat dog"s, options).size(),
+                 full_ids.size());
+    ASSERT_EQUAL(server.GetPartialQueryCount(), 4u);
+
+    // Partial results are not cached
+    server.SetResultCacheCapacity(16);
+    options = {};
+    options.budget.max_scored_postings = 1;
+    ASSERT(server.Search("cat dog"s, DocumentStatus::ACTUAL, options).is_partial);
+    ASSERT(get_ids(server.FindTopDocuments("cat dog"s)) == full_ids);
+    ASSERT_EQUAL(server.GetResultCacheStats().hits, 0u);
+}
+
 void TestSearchServer() {
     RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
     RUN_TEST(TestSearchingAddDocument);
@@ -318,4 +1478,30 @@ void TestSearchServer() {
     RUN_TEST(TestFindTopDocumentsFuncWithStatus);
     RUN_TEST(TestDocumentsRelevanceCalc);
     RUN_TEST(TestProcessQueries);
+    RUN_TEST(TestTermDictionary);
+    RUN_TEST(TestPostingList);
+    RUN_TEST(TestRemoveDocumentReleasesTerms);
+    RUN_TEST(TestReAddedDocument);
+    RUN_TEST(TestAddDocuments);
+    RUN_TEST(TestSegmentedIndex);
+    RUN_TEST(TestConcurrentReadsAndWrites);
+    RUN_TEST(TestSaveAndOpen);
+    RUN_TEST(TestWriteAheadLog);
+    RUN_TEST(TestRemovedDocumentsArePurged);
+    RUN_TEST(TestTermStatistics);
+    RUN_TEST(TestTopDocumentsPage);
+    RUN_TEST(TestBlockMaxWand);
+    RUN_TEST(TestRelevanceAccumulator);
+    RUN_TEST(TestParallelQueryPartitions);
+    RUN_TEST(TestConcurrentMap);
+    RUN_TEST(TestIdKernels);
+    RUN_TEST(TestMatchDocuments);
+    RUN_TEST(TestPreparedQuery);
+    RUN_TEST(TestResultCache);
+    RUN_TEST(TestThreadPool);
+    RUN_TEST(TestFindTopDocumentsBatch);
+    RUN_TEST(TestProcessQueriesJoinedView);
+    RUN_TEST(TestFindTopDocumentsAsync);
+    RUN_TEST(TestQueryBudget);
+    RUN_TEST(TestTombstones);
 }
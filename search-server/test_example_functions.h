@@ -1,9 +1,24 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <random>
+#include <thread>
 
+#include "concurrent_map.h"
 #include "document.h"
+#include "id_kernels.h"
+#include "posting_list.h"
 #include "process_queries.h"
+#include "relevance_accumulator.h"
+#include "request_queue.h"
 #include "search_server.h"
+#include "term_dictionary.h"
+#include "term_statistics.h"
+#include "thread_pool.h"
 
 #define RUN_TEST(func) RunTestImpl((func), #func)
 
@@ -87,3 +102,55 @@ void TestDocumentsRelevanceCalc();
 void TestSearchServer();
 
 void TestProcessQueries();
+
+void TestTermDictionary();
+
+void TestPostingList();
+
+void TestRemoveDocumentReleasesTerms();
+
+void TestReAddedDocument();
+
+void TestAddDocuments();
+
+void TestSegmentedIndex();
+
+void TestConcurrentReadsAndWrites();
+
+void TestSaveAndOpen();
+
+void TestWriteAheadLog();
+
+void TestRemovedDocumentsArePurged();
+
+void TestTermStatistics();
+
+void TestTopDocumentsPage();
+
+void TestBlockMaxWand();
+
+void TestRelevanceAccumulator();
+
+void TestParallelQueryPartitions();
+
+void TestConcurrentMap();
+
+void TestIdKernels();
+
+void TestMatchDocuments();
+
+void TestPreparedQuery();
+
+void TestResultCache();
+
+void TestThreadPool();
+
+void TestFindTopDocumentsBatch();
+
+void TestProcessQueriesJoinedView();
+
+void TestFindTopDocumentsAsync();
+
+void TestQueryBudget();
+
+void TestTombstones();
@@ -0,0 +1,30 @@
+#include "text_arena.h"
+
+#include <algorithm>
+
+using namespace std;
+
+string_view TextArena::Store(string_view text) {
+    if (text.size() > CHUNK_SIZE / 4) {
+        // Long strings get a chunk of their own, so the current chunk is not wasted
+        chunks_.push_back(make_unique<char[]>(text.size()));
+        copy(text.begin(), text.end(), chunks_.back().get());
+        stored_bytes_ += text.size();
+        return {chunks_.back().get(), text.size()};
+    }
+    if (free_space_size_ < text.size() || free_space_ == nullptr) {
+        chunks_.push_back(make_unique<char[]>(CHUNK_SIZE));
+        free_space_ = chunks_.back().get();
+        free_space_size_ = CHUNK_SIZE;
+    }
+    char* data = free_space_;
+    copy(text.begin(), text.end(), data);
+    free_space_ += text.size();
+    free_space_size_ -= text.size();
+    stored_bytes_ += text.size();
+    return {data, text.size()};
+}
+
+size_t TextArena::GetStoredBytes() const {
+    return stored_bytes_;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Append-only storage for short strings.
+// Strings are copied into large chunks, returned views stay valid while the arena is alive.
+class TextArena {
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    std::string_view Store(std::string_view text);
+
+    // Total length of the stored strings
+    size_t GetStoredBytes() const;
+
+private:
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* free_space_ = nullptr;
+    size_t free_space_size_ = 0;
+    size_t stored_bytes_ = 0;
+};
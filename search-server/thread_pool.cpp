@@ -0,0 +1,189 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <exception>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Pool and queue of the current worker thread
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(ThreadPoolOptions options) {
+    const size_t core_count = max<size_t>(thread::hardware_concurrency(), 1);
+    const size_t worker_count = options.worker_count > 0 ? options.worker_count : core_count;
+    for (size_t i = 0; i <= worker_count; ++i) {
+        queues_.push_back(make_unique<TaskQueue>());
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_.emplace_back([this, i]() {
+            RunWorker(i);
+        });
+#ifdef __linux__
+        if (options.pin_workers) {
+            cpu_set_t cores;
+            CPU_ZERO(&cores);
+            CPU_SET(i % core_count, &cores);
+            pthread_setaffinity_np(workers_.back().native_handle(), sizeof(cores), &cores);
+        }
+#endif
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard guard(sleep_mutex_);
+        is_stopped_ = true;
+    }
+    wake_up_.notify_all();
+    for (thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+shared_ptr<ThreadPool> ThreadPool::Create(ThreadPoolOptions options) {
+    return shared_ptr<ThreadPool>(new ThreadPool(options), [](ThreadPool* pool) {
+        if (current_pool == pool) {
+            thread([pool]() {
+                delete pool;
+            }).detach();
+        } else {
+            delete pool;
+        }
+    });
+}
+
+size_t ThreadPool::GetWorkerCount() const {
+    return workers_.size();
+}
+
+void ThreadPool::ParallelFor(size_t count, const function<void(size_t)>& func) {
+    if (count == 0) {
+        return;
+    }
+    // Tasks left in the queues after the return find no indexes and do not touch func
+    struct Batch {
+        const function<void(size_t)>* func;
+        size_t count;
+        atomic<size_t> next_index{0};
+        atomic<size_t> done_count{0};
+        mutex done_mutex;
+        condition_variable done;
+        mutex error_mutex;
+        exception_ptr error;
+    };
+    const auto batch = make_shared<Batch>();
+    batch->func = &func;
+    batch->count = count;
+    const auto run = [batch]() {
+        for (size_t index = batch->next_index.fetch_add(1, memory_order_relaxed);
+             index < batch->count;
+             index = batch->next_index.fetch_add(1, memory_order_relaxed)) {
+            try {
+                (*batch->func)(index);
+            } catch (...) {
+                lock_guard guard(batch->error_mutex);
+                if (!batch->error) {
+                    batch->error = current_exception();
+                }
+            }
+            if (batch->done_count.fetch_add(1, memory_order_acq_rel) + 1 == batch->count) {
+                // Under the lock, so the waiting thread can not miss the notification
+                lock_guard guard(batch->done_mutex);
+                batch->done.notify_all();
+            }
+        }
+    };
+    // Indexes are claimed one by one, so the calling thread and the helpers balance
+    // the load themselves
+    const size_t helper_count = min(count - 1, workers_.size());
+    for (size_t i = 0; i < helper_count; ++i) {
+        Push(run);
+    }
+    run();
+    // Every index left is being run by a thread which is not waiting for this batch
+    {
+        unique_lock lock(batch->done_mutex);
+        batch->done.wait(lock, [&batch, count]() {
+            return batch->done_count.load(memory_order_acquire) == count;
+        });
+    }
+    if (batch->error) {
+        rethrow_exception(batch->error);
+    }
+}
+
+void ThreadPool::Submit(function<void()> task) {
+    Push(move(task));
+}
+
+size_t ThreadPool::GetOwnQueue() const {
+    return current_pool == this ? current_queue : queues_.size() - 1;
+}
+
+void ThreadPool::Push(Task task) {
+    {
+        // Counted before it is queued, so the count never goes below zero, and under the
+        // lock, so a worker going to sleep does not miss the task
+        lock_guard guard(sleep_mutex_);
+        queued_task_count_.fetch_add(1, memory_order_relaxed);
+    }
+    TaskQueue& queue = *queues_[GetOwnQueue()];
+    {
+        lock_guard guard(queue.mutex);
+        queue.tasks.push_back(move(task));
+    }
+    wake_up_.notify_one();
+}
+
+bool ThreadPool::TryRunTask(size_t own_queue) {
+    Task task;
+    {
+        TaskQueue& queue = *queues_[own_queue];
+        lock_guard guard(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+    }
+    for (size_t i = 1; !task && i < queues_.size(); ++i) {
+        TaskQueue& queue = *queues_[(own_queue + i) % queues_.size()];
+        lock_guard guard(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    queued_task_count_.fetch_sub(1, memory_order_relaxed);
+    task();
+    return true;
+}
+
+void ThreadPool::RunWorker(size_t index) {
+    current_pool = this;
+    current_queue = index;
+    while (true) {
+        if (TryRunTask(index)) {
+            continue;
+        }
+        unique_lock lock(sleep_mutex_);
+        wake_up_.wait(lock, [this]() {
+            return is_stopped_ || queued_task_count_.load(memory_order_relaxed) > 0;
+        });
+        if (is_stopped_ && queued_task_count_.load(memory_order_relaxed) == 0) {
+            return;
+        }
+    }
+}
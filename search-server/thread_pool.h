@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPoolOptions {
+    // Zero means a worker per hardware thread
+    size_t worker_count = 0;
+    // Binds worker i to core i modulo the number of cores, on Linux only
+    bool pin_workers = false;
+};
+
+// Persistent pool of workers with a deque of tasks each. A worker takes the newest task of
+// its own deque and steals the oldest one of another deque when its own is empty.
+// The thread which starts a batch runs its indexes too and then sleeps until the ones
+// taken by workers are done, so batches started from inside tasks always finish.
+class ThreadPool {
+public:
+    explicit ThreadPool(ThreadPoolOptions options = {});
+
+    // Pool owned by shared pointers. If a worker of the pool drops the last pointer, the
+    // pool is destroyed on a separate thread, since a worker can not join itself.
+    static std::shared_ptr<ThreadPool> Create(ThreadPoolOptions options = {});
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Waits for the queued tasks. Must not run on a worker of the pool.
+    ~ThreadPool();
+
+    size_t GetWorkerCount() const;
+
+    // Calls func(index) for every index in [0, count) on the workers and the calling
+    // thread and returns once all the calls are done. The calling thread runs indexes of
+    // this batch only. The first exception thrown by func is rethrown after that.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& func);
+
+    // Queues the task to run on a worker and returns at once. The task must not throw.
+    void Submit(std::function<void()> task);
+
+private:
+    using Task = std::function<void()>;
+
+    struct alignas(64) TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // A queue per worker and the last one for threads outside the pool
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> queued_task_count_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_up_;
+    bool is_stopped_ = false;
+
+    // Queue of the calling thread
+    size_t GetOwnQueue() const;
+
+    void Push(Task task);
+
+    // Runs a task of the own queue or a stolen one, returns false if there is none
+    bool TryRunTask(size_t own_queue);
+
+    void RunWorker(size_t index);
+};
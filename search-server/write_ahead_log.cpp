@@ -0,0 +1,237 @@
+#include "write_ahead_log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Record header: payload size, checksum of the rest, sequence number, type
+static const size_t RECORD_HEADER_SIZE = 4 + 4 + 8 + 1;
+
+template <typename T>
+static void AppendValue(string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static T ReadValue(const char* data) {
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// FNV-1a over the sequence number, the type and the payload
+static uint32_t ComputeChecksum(uint64_t sequence_number, LogRecordType type,
+                                string_view payload) {
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+        }
+    };
+    add(reinterpret_cast<const char*>(&sequence_number), sizeof(sequence_number));
+    add(reinterpret_cast<const char*>(&type), sizeof(type));
+    add(payload.data(), payload.size());
+    return hash;
+}
+
+// Returns false if the payload does not match the record type
+static bool ParsePayload(string_view payload, LogRecord& record) {
+    if (payload.size() < sizeof(int32_t)) {
+        return false;
+    }
+    record.document_id = ReadValue<int32_t>(payload.data());
+    payload.remove_prefix(sizeof(int32_t));
+    if (record.type == LogRecordType::REMOVE_DOCUMENT) {
+        return payload.empty();
+    }
+    if (record.type != LogRecordType::ADD_DOCUMENT || payload.size() < 2 * sizeof(int32_t)) {
+        return false;
+    }
+    record.status = static_cast<DocumentStatus>(ReadValue<int32_t>(payload.data()));
+    const uint32_t rating_count = ReadValue<uint32_t>(payload.data() + sizeof(int32_t));
+    payload.remove_prefix(2 * sizeof(int32_t));
+    if (payload.size() / sizeof(int32_t) < rating_count) {
+        return false;
+    }
+    record.ratings.resize(rating_count);
+    for (uint32_t i = 0; i < rating_count; ++i) {
+        record.ratings[i] = ReadValue<int32_t>(payload.data() + i * sizeof(int32_t));
+    }
+    payload.remove_prefix(rating_count * sizeof(int32_t));
+    record.text = string(payload);
+    return true;
+}
+
+static bool WriteAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+WriteAheadLog::WriteAheadLog(const string& path, WriteAheadLogOptions options,
+                             const function<void(const LogRecord&)>& replay)
+    : fd_(open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644))
+    , options_(options) {
+    if (fd_ < 0) {
+        throw runtime_error("Can not open log "s + path);
+    }
+    // Replay may throw, and the destructor does not close fd_ of a throwing constructor
+    try {
+        string content;
+        char chunk[64 * 1024];
+        ssize_t read_size;
+        while ((read_size = read(fd_, chunk, sizeof(chunk))) > 0) {
+            content.append(chunk, read_size);
+        }
+        if (read_size < 0) {
+            throw runtime_error("Can not read log "s + path);
+        }
+
+        size_t valid_size = 0;
+        while (content.size() - valid_size >= RECORD_HEADER_SIZE) {
+            const char* header = content.data() + valid_size;
+            const uint32_t payload_size = ReadValue<uint32_t>(header);
+            if (content.size() - valid_size - RECORD_HEADER_SIZE < payload_size) {
+                break;
+            }
+            LogRecord record;
+            record.sequence_number = ReadValue<uint64_t>(header + 8);
+            record.type = static_cast<LogRecordType>(header[16]);
+            const string_view payload(header + RECORD_HEADER_SIZE, payload_size);
+            if (ReadValue<uint32_t>(header + 4)
+                    != ComputeChecksum(record.sequence_number, record.type, payload)
+                || !ParsePayload(payload, record)) {
+                break;
+            }
+            replay(record);
+            valid_size += RECORD_HEADER_SIZE + payload_size;
+        }
+        // New records go right after the last complete one
+        if (valid_size < content.size() && ftruncate(fd_, valid_size) != 0) {
+            throw runtime_error("Can not truncate log "s + path);
+        }
+        flusher_ = thread([this] {
+            FlushLoop();
+        });
+    } catch (...) {
+        close(fd_);
+        throw;
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        lock_guard guard(mutex_);
+        is_stopped_ = true;
+    }
+    flush_requested_.notify_one();
+    flusher_.join();
+    close(fd_);
+}
+
+void WriteAheadLog::AppendAddDocument(uint64_t sequence_number, int document_id,
+                                      string_view text, DocumentStatus status,
+                                      const vector<int>& ratings) {
+    string payload;
+    payload.reserve(3 * sizeof(int32_t) + ratings.size() * sizeof(int32_t) + text.size());
+    AppendValue<int32_t>(payload, document_id);
+    AppendValue<int32_t>(payload, static_cast<int32_t>(status));
+    AppendValue<uint32_t>(payload, static_cast<uint32_t>(ratings.size()));
+    for (int rating : ratings) {
+        AppendValue<int32_t>(payload, rating);
+    }
+    payload += text;
+    AppendRecord(LogRecordType::ADD_DOCUMENT, sequence_number, payload);
+}
+
+void WriteAheadLog::AppendRemoveDocument(uint64_t sequence_number, int document_id) {
+    string payload;
+    AppendValue<int32_t>(payload, document_id);
+    AppendRecord(LogRecordType::REMOVE_DOCUMENT, sequence_number, payload);
+}
+
+void WriteAheadLog::Sync() {
+    unique_lock lock(mutex_);
+    const uint64_t target = appended_bytes_;
+    is_sync_requested_ = true;
+    flush_requested_.notify_one();
+    flushed_.wait(lock, [this, target] {
+        return flushed_bytes_ >= target || has_failed_;
+    });
+    if (has_failed_) {
+        throw runtime_error("Can not write log"s);
+    }
+}
+
+void WriteAheadLog::Truncate() {
+    Sync();
+    lock_guard file_guard(file_mutex_);
+    if (ftruncate(fd_, 0) != 0 || fdatasync(fd_) != 0) {
+        throw runtime_error("Can not truncate log"s);
+    }
+}
+
+void WriteAheadLog::AppendRecord(LogRecordType type, uint64_t sequence_number,
+                                 string_view payload) {
+    lock_guard guard(mutex_);
+    if (has_failed_) {
+        throw runtime_error("Can not write log"s);
+    }
+    AppendValue<uint32_t>(buffer_, static_cast<uint32_t>(payload.size()));
+    AppendValue<uint32_t>(buffer_, ComputeChecksum(sequence_number, type, payload));
+    AppendValue<uint64_t>(buffer_, sequence_number);
+    AppendValue<LogRecordType>(buffer_, type);
+    buffer_ += payload;
+    appended_bytes_ += RECORD_HEADER_SIZE + payload.size();
+    if (buffer_.size() >= options_.flush_bytes) {
+        flush_requested_.notify_one();
+    }
+}
+
+void WriteAheadLog::FlushLoop() {
+    unique_lock lock(mutex_);
+    while (true) {
+        flush_requested_.wait_for(lock, options_.flush_interval, [this] {
+            return is_stopped_ || is_sync_requested_ || buffer_.size() >= options_.flush_bytes;
+        });
+        is_sync_requested_ = false;
+        if (buffer_.empty()) {
+            flushed_.notify_all();
+            if (is_stopped_) {
+                return;
+            }
+            continue;
+        }
+        string batch;
+        swap(batch, buffer_);
+        const uint64_t batch_end = appended_bytes_;
+        lock.unlock();
+        bool is_written;
+        {
+            lock_guard file_guard(file_mutex_);
+            is_written = WriteAll(fd_, batch.data(), batch.size()) && fdatasync(fd_) == 0;
+        }
+        lock.lock();
+        if (is_written) {
+            flushed_bytes_ = batch_end;
+        } else {
+            has_failed_ = true;
+        }
+        flushed_.notify_all();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+enum class LogRecordType : uint8_t {
+    ADD_DOCUMENT = 1,
+    REMOVE_DOCUMENT = 2,
+};
+
+struct LogRecord {
+    uint64_t sequence_number = 0;
+    LogRecordType type = LogRecordType::ADD_DOCUMENT;
+    int document_id = 0;
+    // Fields below are set for ADD_DOCUMENT only
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+    std::string text;
+};
+
+struct WriteAheadLogOptions {
+    // Appended records are written and synced to disk in batches at least this often
+    std::chrono::milliseconds flush_interval{10};
+    // A batch is flushed early once it grows to this size
+    size_t flush_bytes = 1 << 20;
+};
+
+// Append-only log of document mutations. Appends only copy the record into a buffer,
+// a background thread writes the buffer and syncs the file once per batch (group commit).
+class WriteAheadLog {
+public:
+    // Opens or creates the log and passes the records found in it to replay in order.
+    // A torn record left at the tail by a crash and everything after it is dropped.
+    // Throws std::runtime_error if the file can not be opened.
+    WriteAheadLog(const std::string& path, WriteAheadLogOptions options,
+                  const std::function<void(const LogRecord&)>& replay);
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Writes and syncs the records appended so far
+    ~WriteAheadLog();
+
+    void AppendAddDocument(uint64_t sequence_number, int document_id, std::string_view text,
+                           DocumentStatus status, const std::vector<int>& ratings);
+
+    void AppendRemoveDocument(uint64_t sequence_number, int document_id);
+
+    // Waits until the records appended so far are on disk.
+    // Throws std::runtime_error if the log could not be written.
+    void Sync();
+
+    // Drops all records once they are covered by a saved index
+    void Truncate();
+
+private:
+    int fd_ = -1;
+    WriteAheadLogOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable flush_requested_;
+    std::condition_variable flushed_;
+    std::string buffer_;
+    // Totals since the log was opened
+    uint64_t appended_bytes_ = 0;
+    uint64_t flushed_bytes_ = 0;
+    bool is_sync_requested_ = false;
+    bool is_stopped_ = false;
+    bool has_failed_ = false;
+    // Held while the file is written, so Truncate does not interleave with a batch
+    std::mutex file_mutex_;
+    std::thread flusher_;
+
+    void AppendRecord(LogRecordType type, uint64_t sequence_number, std::string_view payload);
+
+    void FlushLoop();
+};